@@ -58,7 +58,7 @@ which tput >/dev/null 2>&1 || {
 
 mkdir -p $OUTDIR
 printf "\rRender initial image..."
-TIME=$(/usr/bin/time -f "%E" $BIN -q -r $RES -x $X -y $Y -s $S -i $I -c $cI -b $BLOCKDIM -d $SUBDIV -o $OUT $MARK $TRADITIONAL 2>&1 >/dev/null)
+TIME=$(/usr/bin/time -f "%E" $BIN -q --png-level=fast -r $RES -x $X -y $Y -s $S -i $I -c $cI -b $BLOCKDIM -d $SUBDIV -o $OUT $MARK $TRADITIONAL 2>&1 >/dev/null)
 [ $? -ne 0 ] && {
     echo "Failed to render initial image!"
     exit 1
@@ -94,7 +94,7 @@ function help() {
     printf "[e] toggle mariani algorithm on/off\n"
     printf "[o] rerender\n\n"
 
-    printf "Currently calling: %s\n" "$BIN -q -r $RES -x $X -y $Y -s $S -i $I -c $cI -b $BLOCKDIM -d $SUBDIV -o $OUT $MARK $TRADITIONAL"
+    printf "Currently calling: %s\n" "$BIN -q --png-level=fast -r $RES -x $X -y $Y -s $S -i $I -c $cI -b $BLOCKDIM -d $SUBDIV -o $OUT $MARK $TRADITIONAL"
 
     printf "\nPress any key to continue..."
     read -n 1 -s
@@ -236,7 +236,7 @@ while [ $EXEC -gt 0 ]; do
 
     [ $EXEC -eq 1 ] && [ $PAUSE -eq 0 ] && {
         printf "\rRender new image...                   "
-        TIME=$(/usr/bin/time -f "%E" $BIN -q -r $RES -x $X -y $Y -s $S -i $I -c $cI -b $BLOCKDIM -d $SUBDIV -o $OUT $MARK $TRADITIONAL 2>&1 >/dev/null)
+        TIME=$(/usr/bin/time -f "%E" $BIN -q --png-level=fast -r $RES -x $X -y $Y -s $S -i $I -c $cI -b $BLOCKDIM -d $SUBDIV -o $OUT $MARK $TRADITIONAL 2>&1 >/dev/null)
         [ $? -ne 0 ] && {
             echo "Failed rendering image!"
             exit 1
@@ -1,19 +1,33 @@
 
 #include <getopt.h>
 #include <iostream>
+#include <iomanip>
 #include <cmath>
 #include <string>
 #include "utilities/lodepng.h"
 #include "utilities/rgba.hpp"
 #include "utilities/num.hpp"
+#include "utilities/png.hpp"
+#include "utilities/dwell.hpp"
 #include <complex>
 #include <cassert>
+#include <cstring>
 #include <limits>
 #include <deque>
 #include <mutex>
 #include <atomic>
 #include <thread>
 #include <condition_variable>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <cerrno>
+#include <sys/stat.h>
+#ifdef USE_MPI
+// Only the C API is used, it is the one CMake links
+#define OMPI_SKIP_MPICXX 1
+#include <mpi.h>
+#endif
 
 using namespace std;
 
@@ -30,21 +44,309 @@ static std::vector<std::pair<double,rgb>> colourGradient = {
 static unsigned int blockDim = 16;
 static unsigned int subDiv = 4;
 
+// Image size in pixels
+static unsigned int imageWidth = 1024;
+static unsigned int imageHeight = 1024;
+// Pixels spanned by the complex window dc: the shorter side, the longer one extends the window
 static unsigned int res = 1024;
+// Pixel of the image the dwell buffer starts at, only set while rendering a tile of a distributed render
+static unsigned int originY = 0;
+static unsigned int originX = 0;
 static unsigned int maxDwell = 512;
 static bool mark = false;
 
 static constexpr const int  dwellFill = std::numeric_limits<int>::max();
 static constexpr const int  dwellCompute = std::numeric_limits<int>::max()-1;
+// Pixels the interior detection proved to be inside of the set before maxDwell
+static constexpr const int  dwellInterior = std::numeric_limits<int>::max()-2;
 static constexpr const rgba borderFill(255,255,255,255);
 static constexpr const rgba borderCompute(255,0,0,255);
+static constexpr const rgba interiorColour(0,0,0,255);
 static std::vector<rgba> colours;
+// Colour per dwell value 0..maxDwell with the repetition of the colour map folded in
+static std::vector<rgba> dwellColours;
+// Colour map with smoothSteps blended entries between two neighbouring colours
+static std::vector<rgba> smoothColours;
+static constexpr const unsigned int smoothSteps = 16;
+// Squared escape radius of the distance estimation, large so the estimate converges
+static constexpr const double distanceEscape = 1e6;
+// Distance in pixels from which the distance estimation renders white
+static constexpr const float distanceSaturation = 1.0f;
+// Squared |dz/dz0| below which an orbit is considered to be caught by an attracting cycle
+static constexpr const double interiorThreshold = 1e-12;
+static bool interiorDetection = false;
+// Chooses the split of every Mariani-Silver block from its border instead of -d/-b alone
+static bool adaptive = false;
+// Dwell changes per border pixel from which a block counts as busy, i.e. its children won't fill
+static constexpr const double adaptiveBusy = 0.5;
+// Busy blocks up to this many times the min block dimension are computed instead of split
+static constexpr const unsigned int adaptiveComputeBlocks = 2;
+// The recursive engine starts a thread per child only for children at least this big, smaller
+// ones are recursed into on the splitting thread, which bounds the threads of a root block
+static constexpr const unsigned int recursiveThreadBlock = 64;
+
+/**
+* Counters and timers of a render. The counters are always maintained, the timers only run
+* with --stats. The times of the work phases are summed over all threads.
+*/
+struct RenderStats {
+	// Pixels computed and escape iterations run by the kernels
+	unsigned long long evaluated;
+	unsigned long long iterations;
+	// Of the evaluated pixels, those on block borders and cross lines
+	unsigned long long border;
+	// Pixels set by fillBlock
+	unsigned long long filled;
+	// Jobs added to and taken from the queue
+	unsigned long long pushes;
+	unsigned long long pops;
+	// Decisions of the Mariani-Silver blocks: filled, computed, split 2x2, split 4x4
+	unsigned long long decisions[4];
+	// Seconds in the border tests, computing root borders and cross lines, computing and filling blocks
+	double borderTime;
+	double subdivisionTime;
+	double computeTime;
+	double fillTime;
+	// Seconds working and waiting for jobs or the other threads
+	double busy;
+	double idle;
+
+	RenderStats &operator+=(RenderStats const &other) {
+		evaluated += other.evaluated;
+		iterations += other.iterations;
+		border += other.border;
+		filled += other.filled;
+		pushes += other.pushes;
+		pops += other.pops;
+		for (unsigned int i = 0; i < 4; i++) {
+			decisions[i] += other.decisions[i];
+		}
+		borderTime += other.borderTime;
+		subdivisionTime += other.subdivisionTime;
+		computeTime += other.computeTime;
+		fillTime += other.fillTime;
+		busy += other.busy;
+		idle += other.idle;
+		return *this;
+	}
+};
+
+static bool collectStats = false;
+// Every thread counts into its own stats, aligned to a cache line so the hot counters of
+// different threads never share one, and publishes them when it finishes
+alignas(64) static thread_local RenderStats threadStats = {};
+// Sum over all threads and the stats of the worker threads of the last render
+static RenderStats statsTotal = {};
+static std::vector<RenderStats> statsThreads;
+static std::mutex statsMutex;
+
+/**
+* Cost heat map of --heatmap: the iterations every pixel took, heatCostFilled for pixels that
+* were never evaluated, and the Mariani-Silver blocks with the decision taken for them. Kept
+* apart from the dwell buffer, so the rendered image stays untouched.
+*/
+enum class HeatDecision : unsigned char { Fill, Compute, Split };
+
+struct HeatBlock {
+	unsigned int atY;
+	unsigned int atX;
+	unsigned int blockSize;
+	HeatDecision decision;
+	// Iterations run by the job of the block itself, including the cross lines of a split
+	unsigned long long iterations;
+};
+
+static constexpr const unsigned int heatCostFilled = std::numeric_limits<unsigned int>::max();
+static bool heatmap = false;
+static std::vector<unsigned int> heatCost;
+static std::vector<HeatBlock> heatBlocks;
+// Blocks of the calling thread, added to heatBlocks by publishStats
+static thread_local std::vector<HeatBlock> threadHeatBlocks;
+
+inline void recordCost(unsigned int const y, unsigned int const x, unsigned long long const iterations) {
+	if (heatmap) {
+		heatCost[(size_t) y * imageWidth + x] = iterations;
+	}
+}
+
+inline void recordBlock(unsigned int const atY,
+						unsigned int const atX,
+						unsigned int const blockSize,
+						HeatDecision const decision,
+						unsigned long long const iterations)
+{
+	if (heatmap) {
+		threadHeatBlocks.push_back(HeatBlock{ atY, atX, blockSize, decision, iterations });
+	}
+}
+
+// Adds the stats and heat map blocks of the calling thread to the total and to its worker slot (-1 for none)
+void publishStats(int const slot) {
+	std::lock_guard<std::mutex> lock(statsMutex);
+	statsTotal += threadStats;
+	if (slot >= 0) {
+		statsThreads[slot] += threadStats;
+	}
+	threadStats = RenderStats();
+	heatBlocks.insert(heatBlocks.end(), threadHeatBlocks.begin(), threadHeatBlocks.end());
+	threadHeatBlocks.clear();
+}
+
+// Adds the wall time of its scope to seconds, with --stats only
+class StatsTimer {
+public:
+	explicit StatsTimer(double &seconds) : seconds(seconds) {
+		if (collectStats) {
+			start = std::chrono::steady_clock::now();
+		}
+	}
+	~StatsTimer() {
+		if (collectStats) {
+			seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+	}
+
+private:
+	double &seconds;
+	std::chrono::steady_clock::time_point start;
+};
+
+/**
+* Tracer of --trace: every thread records spans into its own ring buffer without any locking,
+* only the first span of a thread registers its buffer. writeTrace() exports all of them as a
+* Chrome trace (chrome://tracing, Perfetto) once the threads are done. A buffer keeps the last
+* traceCapacity spans of its thread.
+*/
+struct TraceEvent {
+	char const *name;
+	long long start;
+	long long duration;
+	// Block of a job, blockSize 0 for spans without one
+	unsigned int atY;
+	unsigned int atX;
+	unsigned int blockSize;
+};
+
+struct TraceBuffer {
+	std::string name;
+	std::vector<TraceEvent> events;
+	unsigned long long recorded;
+};
+
+static constexpr const size_t traceCapacity = 1 << 16;
+static bool tracing = false;
+static std::chrono::steady_clock::time_point traceStart;
+static std::vector<std::unique_ptr<TraceBuffer>> traceBuffers;
+static std::mutex traceMutex;
+static thread_local TraceBuffer *traceBuffer = nullptr;
+
+// Nanoseconds since the start of the trace
+inline long long traceClock() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceStart).count();
+}
+
+TraceBuffer &threadTrace() {
+	if (!traceBuffer) {
+		std::lock_guard<std::mutex> lock(traceMutex);
+		traceBuffers.emplace_back(new TraceBuffer());
+		traceBuffer = traceBuffers.back().get();
+		traceBuffer->name = "thread " + std::to_string(traceBuffers.size() - 1);
+		traceBuffer->recorded = 0;
+	}
+	return *traceBuffer;
+}
+
+// Names the calling thread in the trace
+void traceThread(std::string const &name) {
+	if (tracing) {
+		threadTrace().name = name;
+	}
+}
+
+// Records its scope as a span of the calling thread, with --trace only
+class TraceSpan {
+public:
+	explicit TraceSpan(char const *name, unsigned int const atY = 0, unsigned int const atX = 0, unsigned int const blockSize = 0)
+		: name(name), atY(atY), atX(atX), blockSize(blockSize), start(tracing ? traceClock() : 0) {}
+	~TraceSpan() {
+		if (!tracing) {
+			return;
+		}
+		TraceBuffer &buffer = threadTrace();
+		TraceEvent const event = { name, start, traceClock() - start, atY, atX, blockSize };
+		if (buffer.events.size() < traceCapacity) {
+			buffer.events.push_back(event);
+		} else {
+			buffer.events[buffer.recorded % traceCapacity] = event;
+		}
+		buffer.recorded++;
+	}
+
+private:
+	char const *name;
+	unsigned int atY;
+	unsigned int atX;
+	unsigned int blockSize;
+	long long start;
+};
+
+// Writes the recorded spans as Chrome trace JSON and returns the number of spans lost to full buffers
+unsigned long long writeTrace(std::ostream &out) {
+	unsigned long long dropped = 0;
+	out << std::fixed << std::setprecision(3);
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+	out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"mandel\"}}";
+	for (size_t tid = 0; tid < traceBuffers.size(); tid++) {
+		TraceBuffer const &buffer = *traceBuffers[tid];
+		dropped += buffer.recorded - buffer.events.size();
+		out << "," << std::endl << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+			<< ",\"args\":{\"name\":\"" << buffer.name << "\"}}";
+		for (TraceEvent const &event : buffer.events) {
+			// Chrome traces count in microseconds
+			out << "," << std::endl << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+				<< ",\"ts\":" << event.start / 1000.0 << ",\"dur\":" << event.duration / 1000.0;
+			if (event.blockSize > 0) {
+				out << ",\"args\":{\"y\":" << event.atY << ",\"x\":" << event.atX << ",\"size\":" << event.blockSize << "}";
+			}
+			out << "}";
+		}
+	}
+	out << std::endl << "]}" << std::endl;
+	return dropped;
+}
+
+inline bool isInterior(int const dwell) {
+	return dwell == (int) maxDwell || dwell == dwellInterior;
+}
 
 std::mutex mutexVariable;
 
+/**
+* Splits the rows [0, rows) into one contiguous band per hardware thread and calls
+* body(begin, end) for every band on its own thread. With serial the calling thread
+* runs body(0, rows) itself.
+*/
+template <typename Body>
+void parallelRows(unsigned int const rows, Body const &body, bool const serial = false) {
+	if (serial) {
+		body(0u, rows);
+		return;
+	}
+	unsigned int const numThreads = std::max(1u, std::min(rows, thread::hardware_concurrency()));
+	vector<thread> threads;
+	for (unsigned int i = 0; i < numThreads; i++) {
+		threads.push_back(thread(body, (unsigned int) ((unsigned long long) rows * i / numThreads),
+										(unsigned int) ((unsigned long long) rows * (i + 1) / numThreads)));
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+}
+
 void createColourMap(unsigned int const maxDwell) {
 	rgb colour(0,0,0);
 	double pos = 0.0;
+	colours.clear();
 
 	//Adding the last value if its not there...
 	if (colourGradient.size() == 0 || colourGradient.back().first != 1.0) {
@@ -73,63 +375,548 @@ void createColourMap(unsigned int const maxDwell) {
 
 
 
-rgba const &dwellColor(std::complex<double> const z, unsigned int const dwell) {
-	static constexpr const double log2 = 0.693147180559945309417232121458176568075500134360255254120;
+/**
+* Builds the lookup tables of the colouring stage from the colour map, so mapping a pixel
+* is a single table lookup instead of a modulo and a bounds checked access.
+*/
+void createColourTables(unsigned int const maxDwell) {
 	assert(colours.size() > 0);
+	dwellColours.resize(maxDwell + 1);
+	for (unsigned int dwell = 0; dwell <= maxDwell; dwell++) {
+		rgba const &colour = colours[dwell % colours.size()];
+		dwellColours[dwell] = rgba(colour.r, colour.g, colour.b, colour.a);
+	}
+	smoothColours.resize(colours.size() * smoothSteps);
+	for (size_t i = 0; i < colours.size(); i++) {
+		rgba const &from = colours[i];
+		rgba const &to = colours[(i + 1) % colours.size()];
+		for (unsigned int step = 0; step < smoothSteps; step++) {
+			double const blend = (double) step / smoothSteps;
+			smoothColours[i * smoothSteps + step] = rgba(
+				from.r + blend * (to.r - from.r),
+				from.g + blend * (to.g - from.g),
+				from.b + blend * (to.b - from.b),
+				255
+			);
+		}
+	}
+}
+
+/**
+* Histogram equalization: respreads the colour map over the escaping dwell values by their
+* cumulative frequency, so every colour covers about the same number of pixels. The histogram
+* is built in one parallel pass with private bins per row band, merged afterwards.
+*/
+void equalizeColourTable(DwellBuffer const &dwellBuffer) {
+	unsigned int const lastDwell = dwellColours.size() - 1;
+	std::vector<unsigned long long> histogram(lastDwell + 1, 0);
+	std::mutex histogramMutex;
+	parallelRows(dwellBuffer.height(), [&](unsigned int const begin, unsigned int const end) {
+		std::vector<unsigned long long> bins(lastDwell + 1, 0);
+		for (unsigned int y = begin; y < end; y++) {
+			int const *dwell = dwellBuffer.row(y);
+			for (unsigned int x = 0; x < dwellBuffer.width(); x++) {
+				if ((unsigned int) dwell[x] <= lastDwell) {
+					bins[dwell[x]]++;
+				}
+			}
+		}
+		std::lock_guard<std::mutex> lock(histogramMutex);
+		for (unsigned int i = 0; i <= lastDwell; i++) {
+			histogram[i] += bins[i];
+		}
+	});
+
+	// The interior (maxDwell) keeps its colour and is not part of the distribution
+	unsigned long long escaped = 0;
+	for (unsigned int i = 0; i < lastDwell; i++) {
+		escaped += histogram[i];
+	}
+	if (escaped == 0) {
+		return;
+	}
+	unsigned long long cumulative = 0;
+	for (unsigned int i = 0; i < lastDwell; i++) {
+		cumulative += histogram[i];
+		size_t const index = std::min(colours.size() - 1, (size_t) ((double) cumulative / escaped * (colours.size() - 1)));
+		rgba const &colour = colours[index];
+		dwellColours[i] = rgba(colour.r, colour.g, colour.b, colour.a);
+	}
+}
+
+// Colour of a dwell value outside of 0..maxDwell, i.e. the border markers
+rgba const &markerColour(int const dwell) {
+	static constexpr const rgba unknown(0,0,0,255);
 	switch (dwell) {
 		case dwellFill:
 			return borderFill;
 		case dwellCompute:
 			return borderCompute;
+		case dwellInterior:
+			return interiorColour;
 	}
-	unsigned int index = dwell + 1 - std::log(std::log(std::abs(z))/log2);
-	return colours.at(index % colours.size());
+	return unknown;
+}
+
+// Squared escape radius of the escape time kernels
+static constexpr const double dwellEscape = 4.0 * 4.0;
+
+// Normalized fractional iteration count of an orbit that escaped at z
+inline float smoothFraction(double const zr, double const zi) {
+	static const double logEscape = std::log(4.0);
+	// |z| lies in [4;16+|c|) after the escaping iteration, so this is in [0;1)
+	float const value = std::log2(0.5 * std::log(zr * zr + zi * zi) / logEscape);
+	return std::min(std::max(value, 0.0f), std::nextafter(1.0f, 0.0f));
 }
 
+/**
+* Escape time kernel for the point at pixel coordinates (y, x). With smooth the normalized
+* fractional iteration count is written to fraction: how far the continuous dwell, derived from
+* |z| at escape, lies below the integer dwell. With interior the derivative of the orbit with respect to its start is tracked as well:
+* once it vanishes the orbit converges to an attracting cycle and the pixel is reported as
+* dwellInterior without iterating up to maxDwell. Without both it is the plain dwell loop.
+*/
+template <bool smooth, bool interior>
 unsigned int pixelDwell(std::complex<double> const &cmin,
 						std::complex<double> const &dc,
-						unsigned int const y,
-						unsigned int const x)
+						double const y,
+						double const x,
+						float *fraction)
+{
+	// Spelled out in real arithmetic, so the lanes of dwellLanes perform exactly the same operations
+	double const cr = cmin.real() + ((x + originX) / res) * dc.real();
+	double const ci = cmin.imag() + ((y + originY) / res) * dc.imag();
+	double zr = cr, zi = ci, dr = 1.0, di = 0.0;
+	unsigned int dwell = 0;
+
+	while(dwell < maxDwell && zr * zr + zi * zi < dwellEscape) {
+		if (interior) {
+			double const ndr = 2.0 * zr * dr - 2.0 * zi * di;
+			di = 2.0 * zr * di + 2.0 * zi * dr;
+			dr = ndr;
+		}
+		double const nzi = 2.0 * zr * zi + ci;
+		zr = zr * zr - zi * zi + cr;
+		zi = nzi;
+		dwell++;
+		if (interior && dr * dr + di * di < interiorThreshold) {
+			threadStats.iterations += dwell;
+			if (smooth) {
+				*fraction = 0.0f;
+			}
+			return dwellInterior;
+		}
+	}
+
+	threadStats.iterations += dwell;
+	if (smooth) {
+		*fraction = (dwell < maxDwell) ? smoothFraction(zr, zi) : 0.0f;
+	}
+	return dwell;
+}
+
+// Doubles processed together: four with AVX enabled (e.g. -march=native), otherwise two in an
+// SSE2 register. Wider vectors than the target supports are split into badly scheduled halves.
+#ifdef __AVX__
+typedef double doubleLanes __attribute__((vector_size(32)));
+typedef long long laneMask __attribute__((vector_size(32)));
+#else
+typedef double doubleLanes __attribute__((vector_size(16)));
+typedef long long laneMask __attribute__((vector_size(16)));
+#endif
+static constexpr const unsigned int laneCount = sizeof(doubleLanes) / sizeof(double);
+
+inline bool anyLane(laneMask const mask) {
+	long long any = 0;
+	for (unsigned int lane = 0; lane < laneCount; lane++) {
+		any |= mask[lane];
+	}
+	return any != 0;
+}
+
+// mask ? a : b per lane as a bitwise blend, the vector ?: gets split into scalar branches
+inline doubleLanes select(laneMask const mask, doubleLanes const a, doubleLanes const b) {
+	return (doubleLanes) (((laneMask) a & mask) | ((laneMask) b & ~mask));
+}
+
+/**
+* Distance estimation kernel: iterates the derivative dz/dc alongside z and writes the exterior
+* distance estimate |z| log|z| / 2|dz| in pixels to distance, 0 inside the set.
+*/
+unsigned int pixelDistance(std::complex<double> const &cmin,
+						   std::complex<double> const &dc,
+						   double const y,
+						   double const x,
+						   float *distance)
 {
-	double const fy = (double)y / res;
-	double const fx = (double)x / res;
-	std::complex<double> const c = cmin + std::complex<double>(fx * dc.real(), fy * dc.imag());
-	std::complex<double> z = c;
+	double const cr = cmin.real() + ((x + originX) / res) * dc.real();
+	double const ci = cmin.imag() + ((y + originY) / res) * dc.imag();
+	double zr = cr, zi = ci, dr = 1.0, di = 0.0;
 	unsigned int dwell = 0;
 
-	while(dwell < maxDwell && std::abs(z) < (2 * 2)) {
-		z = z * z + c;
+	while(dwell < maxDwell && zr * zr + zi * zi < distanceEscape) {
+		double const ndr = 2.0 * (zr * dr - zi * di) + 1.0;
+		double const ndi = 2.0 * (zr * di + zi * dr);
+		double const nzi = 2.0 * zr * zi + ci;
+		zr = zr * zr - zi * zi + cr;
+		zi = nzi;
+		dr = ndr;
+		di = ndi;
 		dwell++;
 	}
+	threadStats.iterations += dwell;
 
+	*distance = 0.0f;
+	if (dwell < maxDwell) {
+		double const z2 = zr * zr + zi * zi;
+		double const dz2 = dr * dr + di * di;
+		*distance = 0.25 * std::sqrt(z2 / dz2) * std::log(z2) * res / dc.real();
+	}
 	return dwell;
 }
 
-int commonBorder(std::vector<std::vector<int>> &dwellBuffer,
+
+/**
+* Distance estimation of the pixels [xBegin, xEnd) of a row, laneCount at a time. Lanes freeze once
+* they escaped, so every lane performs the same operations as pixelDistance.
+*/
+void distanceRow(DwellBuffer &dwellBuffer,
 				 std::complex<double> const &cmin,
 				 std::complex<double> const &dc,
-				 unsigned int const atY,
-				 unsigned int const atX,
-				 unsigned int const blockSize)
+				 unsigned int const y,
+				 unsigned int const xBegin,
+				 unsigned int const xEnd)
 {
-	unsigned int const yMax = (res > atY + blockSize - 1) ? atY + blockSize - 1 : res - 1;
-	unsigned int const xMax = (res > atX + blockSize - 1) ? atX + blockSize - 1 : res - 1;
-	int commonDwell = -1;
+	double const ci = cmin.imag() + ((double)(y + originY) / res) * dc.imag();
+	int *dwellRow = dwellBuffer.row(y);
+	float *distances = dwellBuffer.distanceRow(y);
+	unsigned int x = xBegin;
+	for (; x + laneCount <= xEnd; x += laneCount) {
+		doubleLanes cr;
+		for (unsigned int lane = 0; lane < laneCount; lane++) {
+			cr[lane] = cmin.real() + ((double)(x + lane + originX) / res) * dc.real();
+		}
+		doubleLanes const zero = {};
+		doubleLanes const civ = zero + ci;
+		doubleLanes zr = cr, zi = civ;
+		doubleLanes dr = zero + 1.0, di = zero;
+		laneMask dwell = {};
+		for (unsigned int i = 0; i < maxDwell; i++) {
+			laneMask const active = (zr * zr + zi * zi) < distanceEscape;
+			if (!anyLane(active)) {
+				break;
+			}
+			doubleLanes const ndr = 2.0 * (zr * dr - zi * di) + 1.0;
+			doubleLanes const ndi = 2.0 * (zr * di + zi * dr);
+			doubleLanes const nzr = zr * zr - zi * zi + cr;
+			doubleLanes const nzi = 2.0 * zr * zi + civ;
+			zr = select(active, nzr, zr);
+			zi = select(active, nzi, zi);
+			dr = select(active, ndr, dr);
+			di = select(active, ndi, di);
+			// active is -1 in every lane still iterating
+			dwell -= active;
+		}
+		for (unsigned int lane = 0; lane < laneCount; lane++) {
+			threadStats.iterations += dwell[lane];
+			recordCost(y, x + lane, dwell[lane]);
+			dwellRow[x + lane] = dwell[lane];
+			distances[x + lane] = 0.0f;
+			if ((unsigned int) dwell[lane] < maxDwell) {
+				double const z2 = zr[lane] * zr[lane] + zi[lane] * zi[lane];
+				double const dz2 = dr[lane] * dr[lane] + di[lane] * di[lane];
+				distances[x + lane] = 0.25 * std::sqrt(z2 / dz2) * std::log(z2) * res / dc.real();
+			}
+		}
+	}
+	for (; x < xEnd; x++) {
+		dwellRow[x] = pixelDistance(cmin, dc, y, x, &distances[x]);
+		recordCost(y, x, dwellRow[x]);
+	}
+}
+
+/**
+* pixelDwell for laneCount arbitrary pixels at once, e.g. a run of a row or pixels gathered from a
+* column. Lanes freeze once they escaped or were found interior and the loop ends as soon as
+* no lane is active any more. Only the first lanes pixels are stored and counted, the others
+* are padding of a partial batch.
+*/
+template <bool smooth, bool interior>
+void dwellLanes(DwellBuffer &dwellBuffer,
+				std::complex<double> const &cmin,
+				std::complex<double> const &dc,
+				unsigned int const *ys,
+				unsigned int const *xs,
+				unsigned int const lanes)
+{
+	doubleLanes cr, ci;
+	for (unsigned int lane = 0; lane < laneCount; lane++) {
+		cr[lane] = cmin.real() + ((double)(xs[lane] + originX) / res) * dc.real();
+		ci[lane] = cmin.imag() + ((double)(ys[lane] + originY) / res) * dc.imag();
+	}
+	doubleLanes zr = cr, zi = ci;
+	doubleLanes const zero = {};
+	doubleLanes dr = zero + 1.0, di = zero;
+	laneMask dwell = {}, inside = {};
+	for (unsigned int i = 0; i < maxDwell; i++) {
+		laneMask active = (zr * zr + zi * zi) < dwellEscape;
+		if (interior) {
+			active &= ~inside;
+		}
+		if (!anyLane(active)) {
+			break;
+		}
+		if (interior) {
+			doubleLanes const ndr = 2.0 * zr * dr - 2.0 * zi * di;
+			doubleLanes const ndi = 2.0 * zr * di + 2.0 * zi * dr;
+			dr = select(active, ndr, dr);
+			di = select(active, ndi, di);
+		}
+		doubleLanes const nzr = zr * zr - zi * zi + cr;
+		doubleLanes const nzi = 2.0 * zr * zi + ci;
+		zr = select(active, nzr, zr);
+		zi = select(active, nzi, zi);
+		// active is -1 in every lane still iterating
+		dwell -= active;
+		if (interior) {
+			inside |= active & ((dr * dr + di * di) < interiorThreshold);
+		}
+	}
+	for (unsigned int lane = 0; lane < lanes; lane++) {
+		threadStats.iterations += dwell[lane];
+		recordCost(ys[lane], xs[lane], dwell[lane]);
+		int value = dwell[lane];
+		if (interior && inside[lane]) {
+			value = dwellInterior;
+		}
+		dwellBuffer.at(ys[lane], xs[lane]) = value;
+		if (smooth) {
+			dwellBuffer.fraction(ys[lane], xs[lane]) = (value < (int) maxDwell) ? smoothFraction(zr[lane], zi[lane]) : 0.0f;
+		}
+	}
+}
+
+// Computes a single pixel, including its fraction or distance if the buffer records one
+inline void computePixel(DwellBuffer &dwellBuffer,
+						 std::complex<double> const &cmin,
+						 std::complex<double> const &dc,
+						 unsigned int const y,
+						 unsigned int const x)
+{
+	threadStats.evaluated++;
+	unsigned long long const iterations = threadStats.iterations;
+	if (dwellBuffer.hasDistance()) {
+		dwellBuffer.at(y, x) = pixelDistance(cmin, dc, y, x, &dwellBuffer.distance(y, x));
+	} else if (dwellBuffer.hasFraction()) {
+		dwellBuffer.at(y, x) = interiorDetection ? pixelDwell<true, true>(cmin, dc, y, x, &dwellBuffer.fraction(y, x))
+												 : pixelDwell<true, false>(cmin, dc, y, x, &dwellBuffer.fraction(y, x));
+	} else {
+		dwellBuffer.at(y, x) = interiorDetection ? pixelDwell<false, true>(cmin, dc, y, x, nullptr)
+												 : pixelDwell<false, false>(cmin, dc, y, x, nullptr);
+	}
+	recordCost(y, x, threadStats.iterations - iterations);
+}
+
+/**
+* Computes count arbitrary pixels, laneCount at a time. A partial batch is padded with its last
+* pixel, which takes as many iterations as the pixel itself and is neither stored nor counted.
+*/
+void computeBatch(DwellBuffer &dwellBuffer,
+				  std::complex<double> const &cmin,
+				  std::complex<double> const &dc,
+				  unsigned int const *ys,
+				  unsigned int const *xs,
+				  unsigned int const count)
+{
+	if (dwellBuffer.hasDistance()) {
+		for (unsigned int i = 0; i < count; i++) {
+			computePixel(dwellBuffer, cmin, dc, ys[i], xs[i]);
+		}
+		return;
+	}
+	threadStats.evaluated += count;
+	for (unsigned int i = 0; i < count; i += laneCount) {
+		unsigned int batchY[laneCount], batchX[laneCount];
+		unsigned int const lanes = std::min(laneCount, count - i);
+		for (unsigned int lane = 0; lane < laneCount; lane++) {
+			unsigned int const at = std::min(i + lane, count - 1);
+			batchY[lane] = ys[at];
+			batchX[lane] = xs[at];
+		}
+		if (dwellBuffer.hasFraction()) {
+			if (interiorDetection) dwellLanes<true, true>(dwellBuffer, cmin, dc, batchY, batchX, lanes);
+			else dwellLanes<true, false>(dwellBuffer, cmin, dc, batchY, batchX, lanes);
+		} else {
+			if (interiorDetection) dwellLanes<false, true>(dwellBuffer, cmin, dc, batchY, batchX, lanes);
+			else dwellLanes<false, false>(dwellBuffer, cmin, dc, batchY, batchX, lanes);
+		}
+	}
+}
+
+/**
+* Collects pixel coordinates and hands them to computeBatch in groups, so scattered pixels,
+* e.g. the columns of a border, are computed by the vectorized kernels as well.
+*/
+class PixelBatch {
+public:
+	PixelBatch(DwellBuffer &dwellBuffer, std::complex<double> const &cmin, std::complex<double> const &dc)
+		: dwellBuffer(dwellBuffer), cmin(cmin), dc(dc), count(0) {}
+	~PixelBatch() { flush(); }
+
+	void add(unsigned int const y, unsigned int const x) {
+		ys[count] = y;
+		xs[count] = x;
+		if (++count == size) {
+			flush();
+		}
+	}
+
+	void flush() {
+		if (count > 0) {
+			computeBatch(dwellBuffer, cmin, dc, ys, xs, count);
+			count = 0;
+		}
+	}
+
+private:
+	static constexpr const unsigned int size = 16;
+	DwellBuffer &dwellBuffer;
+	std::complex<double> const &cmin;
+	std::complex<double> const &dc;
+	unsigned int ys[size];
+	unsigned int xs[size];
+	unsigned int count;
+};
+
+// Computes the pixels [xBegin, xEnd) of row y
+inline void computeRow(DwellBuffer &dwellBuffer,
+					   std::complex<double> const &cmin,
+					   std::complex<double> const &dc,
+					   unsigned int const y,
+					   unsigned int const xBegin,
+					   unsigned int const xEnd)
+{
+	if (dwellBuffer.hasDistance()) {
+		threadStats.evaluated += xEnd - xBegin;
+		distanceRow(dwellBuffer, cmin, dc, y, xBegin, xEnd);
+		return;
+	}
+	PixelBatch batch(dwellBuffer, cmin, dc);
+	for (unsigned int x = xBegin; x < xEnd; x++) {
+		batch.add(y, x);
+	}
+}
+
+// Distance a block is filled with by the distance estimation: a lower bound of its pixels
+inline float fillDistance(unsigned int const blockSize) {
+	return std::max((float) (blockSize * std::sqrt(2.0)), distanceSaturation);
+}
+
+/**
+* Border test of the distance estimation. A block is outside of the set if the distance
+* estimate of all of its border pixels is at least its diagonal: the set can't reach into
+* the block without getting closer to one of them. Returns the smallest border dwell for
+* such a block, maxDwell for a border inside the set and -1 if the block has to be split.
+*/
+int distanceBorder(DwellBuffer &dwellBuffer,
+				   std::complex<double> const &cmin,
+				   std::complex<double> const &dc,
+				   unsigned int const atY,
+				   unsigned int const atX,
+				   unsigned int const blockSize)
+{
+	unsigned int const yMax = (imageHeight > atY + blockSize - 1) ? atY + blockSize - 1 : imageHeight - 1;
+	unsigned int const xMax = (imageWidth > atX + blockSize - 1) ? atX + blockSize - 1 : imageWidth - 1;
+	float const minDistance = fillDistance(blockSize);
+	bool interior = true;
+	bool exterior = true;
+	int minDwell = maxDwell;
 	for (unsigned int i = 0; i < blockSize; i++) {
 		for (unsigned int s = 0; s < 4; s++) {
 			unsigned const int y = s % 2 == 0 ? atY + i : (s == 1 ? yMax : atY);
 			unsigned const int x = s % 2 != 0 ? atX + i : (s == 0 ? xMax : atX);
-			if (y < res && x < res) {
-				if (dwellBuffer.at(y).at(x) < 0) {
-					dwellBuffer.at(y).at(x) = pixelDwell(cmin, dc, y, x);
-				}
-				if (commonDwell == -1) {
-					commonDwell = dwellBuffer.at(y).at(x);
-				} else if (commonDwell != dwellBuffer.at(y).at(x)) {
-					return -1;
+			if (y < imageHeight && x < imageWidth) {
+				if (dwellBuffer.at(y, x) < 0) {
+					computePixel(dwellBuffer, cmin, dc, y, x);
+					threadStats.border++;
 				}
+				int const dwell = dwellBuffer.at(y, x);
+				interior = interior && dwell == (int) maxDwell;
+				exterior = exterior && dwell < (int) maxDwell && dwellBuffer.distance(y, x) >= minDistance;
+				minDwell = std::min(minDwell, dwell);
+			}
+		}
+	}
+	if (interior) {
+		return maxDwell;
+	}
+	return exterior ? minDwell : -1;
+}
+
+int commonBorder(DwellBuffer &dwellBuffer,
+				 std::complex<double> const &cmin,
+				 std::complex<double> const &dc,
+				 unsigned int const atY,
+				 unsigned int const atX,
+				 unsigned int const blockSize)
+{
+	if (dwellBuffer.hasDistance()) {
+		return distanceBorder(dwellBuffer, cmin, dc, atY, atX, blockSize);
+	}
+	if (atY >= imageHeight || atX >= imageWidth) {
+		return -1;
+	}
+	unsigned int const yMax = (imageHeight > atY + blockSize - 1) ? atY + blockSize - 1 : imageHeight - 1;
+	unsigned int const xMax = (imageWidth > atX + blockSize - 1) ? atX + blockSize - 1 : imageWidth - 1;
+	int commonDwell = -1;
+	// The border is visited side by side in groups of laneCount pixels: the missing ones of a
+	// group are computed together and the walk stops at the first group that disagrees
+	unsigned int ys[laneCount], xs[laneCount], count = 0;
+	auto compare = [&]() {
+		unsigned int pendingY[laneCount], pendingX[laneCount], pending = 0;
+		for (unsigned int i = 0; i < count; i++) {
+			if (dwellBuffer.at(ys[i], xs[i]) < 0) {
+				pendingY[pending] = ys[i];
+				pendingX[pending++] = xs[i];
+			}
+		}
+		if (pending > 0) {
+			computeBatch(dwellBuffer, cmin, dc, pendingY, pendingX, pending);
+			threadStats.border += pending;
+		}
+		for (unsigned int i = 0; i < count; i++) {
+			int const dwell = dwellBuffer.at(ys[i], xs[i]);
+			if (commonDwell == -1) {
+				commonDwell = dwell;
+			} else if (commonDwell != dwell) {
+				return false;
 			}
 		}
+		count = 0;
+		return true;
+	};
+	auto visit = [&](unsigned int const y, unsigned int const x) {
+		ys[count] = y;
+		xs[count++] = x;
+		return count < laneCount || compare();
+	};
+	// Top and bottom rows are contiguous, the columns in between strided
+	for (unsigned int x = atX; x <= xMax; x++) {
+		if (!visit(atY, x)) return -1;
+	}
+	for (unsigned int x = atX; x <= xMax && yMax != atY; x++) {
+		if (!visit(yMax, x)) return -1;
+	}
+	for (unsigned int y = atY + 1; y < yMax; y++) {
+		if (!visit(y, atX)) return -1;
+		if (xMax != atX && !visit(y, xMax)) return -1;
+	}
+	if (!compare()) {
+		return -1;
+	}
+	// The fraction varies inside a block of common escaping dwell, only the interior is filled
+	if (dwellBuffer.hasFraction() && !isInterior(commonDwell)) {
+		return -1;
 	}
 	return commonDwell;
 }
@@ -147,22 +934,22 @@ void threadedCommonBorder(
 	unsigned int xMax,
 	unsigned int atY,
 	unsigned int atX,
-	std::vector<std::vector<int>> &dwellBuffer,
+	DwellBuffer &dwellBuffer,
 	int& commonDwell,
 	std::complex<double> const &cmin,
 	std::complex<double> const &dc
 ) {
 	unsigned const int y = s % 2 == 0 ? atY + i : (s == 1 ? yMax : atY);
 	unsigned const int x = s % 2 != 0 ? atX + i : (s == 0 ? xMax : atX);
-	if (y < res && x < res) {
-		if (dwellBuffer.at(y).at(x) < 0) {
-			dwellBuffer.at(y).at(x) = pixelDwell(cmin, dc, y, x);
+	if (y < imageHeight && x < imageWidth) {
+		if (dwellBuffer.at(y, x) < 0) {
+			computePixel(dwellBuffer, cmin, dc, y, x);
 		}
 		mutexVariable.lock();
 
 		if (commonDwell == -1) {
-			commonDwell = dwellBuffer.at(y).at(x);
-		} else if (commonDwell != dwellBuffer.at(y).at(x)) {
+			commonDwell = dwellBuffer.at(y, x);
+		} else if (commonDwell != dwellBuffer.at(y, x)) {
 			commonDwell = -2;
 		}
 
@@ -173,15 +960,18 @@ void threadedCommonBorder(
 /**
 * Parallelized version. At most 4 threads are executed in parallel, so to compute the common border.
 */
-int multipleThreadCommonBorder(std::vector<std::vector<int>> &dwellBuffer,
+int multipleThreadCommonBorder(DwellBuffer &dwellBuffer,
 				 std::complex<double> const &cmin,
 				 std::complex<double> const &dc,
 				 unsigned int const atY,
 				 unsigned int const atX,
 				 unsigned int const blockSize)
 {
-	unsigned int const yMax = (res > atY + blockSize - 1) ? atY + blockSize - 1 : res - 1;
-	unsigned int const xMax = (res > atX + blockSize - 1) ? atX + blockSize - 1 : res - 1;
+	if (dwellBuffer.hasDistance()) {
+		return distanceBorder(dwellBuffer, cmin, dc, atY, atX, blockSize);
+	}
+	unsigned int const yMax = (imageHeight > atY + blockSize - 1) ? atY + blockSize - 1 : imageHeight - 1;
+	unsigned int const xMax = (imageWidth > atX + blockSize - 1) ? atX + blockSize - 1 : imageWidth - 1;
 	int commonDwell = -1;
 	for (unsigned int i = 0; i < blockSize; i++) {
 		vector<thread> threads;
@@ -211,31 +1001,34 @@ int multipleThreadCommonBorder(std::vector<std::vector<int>> &dwellBuffer,
 		}
 	}
 
+	if (dwellBuffer.hasFraction() && !isInterior(commonDwell)) {
+		return -1;
+	}
 	return commonDwell;
 }
 
-void markBorder(std::vector<std::vector<int>> &dwellBuffer,
+void markBorder(DwellBuffer &dwellBuffer,
 				int const dwell,
 				unsigned int const atY,
 				unsigned int const atX,
 				unsigned int const blockSize)
 {
-	unsigned int const yMax = (res > atY + blockSize - 1) ? atY + blockSize - 1 : res - 1;
-	unsigned int const xMax = (res > atX + blockSize - 1) ? atX + blockSize - 1 : res - 1;
+	unsigned int const yMax = (imageHeight > atY + blockSize - 1) ? atY + blockSize - 1 : imageHeight - 1;
+	unsigned int const xMax = (imageWidth > atX + blockSize - 1) ? atX + blockSize - 1 : imageWidth - 1;
 	//#pragma omp parallel for
 	for (unsigned int i = 0; i < blockSize; i++) {
 		//#pragma omp parallel for
 		for (unsigned int s = 0; s < 4; s++) {
 			unsigned const int y = s % 2 == 0 ? atY + i : (s == 1 ? yMax : atY);
 			unsigned const int x = s % 2 != 0 ? atX + i : (s == 0 ? xMax : atX);
-			if (y < res && x < res) {
-				dwellBuffer.at(y).at(x) = dwell;
+			if (y < imageHeight && x < imageWidth) {
+				dwellBuffer.at(y, x) = dwell;
 			}
 		}
 	}
 }
 
-void computeBlock(std::vector<std::vector<int>> &dwellBuffer,
+void computeBlock(DwellBuffer &dwellBuffer,
 	std::complex<double> const &cmin,
 	std::complex<double> const &dc,
 	unsigned int const atY,
@@ -243,19 +1036,17 @@ void computeBlock(std::vector<std::vector<int>> &dwellBuffer,
 	unsigned int const blockSize,
 	unsigned int const omitBorder = 0)
 {
-	unsigned int const yMax = (res > atY + blockSize) ? atY + blockSize : res;
-	unsigned int const xMax = (res > atX + blockSize) ? atX + blockSize : res;
+	unsigned int const yMax = (imageHeight > atY + blockSize) ? atY + blockSize : imageHeight;
+	unsigned int const xMax = (imageWidth > atX + blockSize) ? atX + blockSize : imageWidth;
 	for (unsigned int y = atY + omitBorder; y < yMax - omitBorder; y++) {
-		for (unsigned int x = atX + omitBorder; x < xMax - omitBorder; x++) {
-			dwellBuffer.at(y).at(x) = pixelDwell(cmin, dc, y, x);
-		}
+		computeRow(dwellBuffer, cmin, dc, y, atX + omitBorder, xMax - omitBorder);
 	}
 }
 
 /**
 * Parallelized version. Only changes the yMax
 */
-void threadedComputeBlock(std::vector<std::vector<int>> &dwellBuffer,
+void threadedComputeBlock(DwellBuffer &dwellBuffer,
 	std::complex<double> const &cmin,
 	std::complex<double> const &dc,
 	unsigned int const atY,
@@ -263,37 +1054,168 @@ void threadedComputeBlock(std::vector<std::vector<int>> &dwellBuffer,
 	unsigned int const blockSize,
 	unsigned int const omitBorder = 0)
 {
-	unsigned int const yMax = (res > atY + blockSize) ? atY + blockSize : res;
-	unsigned int const xMax = res;
+	unsigned int const yMax = (imageHeight > atY + blockSize) ? atY + blockSize : imageHeight;
+	unsigned int const xMax = imageWidth;
 	for (unsigned int y = atY + omitBorder; y < yMax - omitBorder; y++) {
-		for (unsigned int x = atX + omitBorder; x < xMax - omitBorder; x++) {
-			dwellBuffer.at(y).at(x) = pixelDwell(cmin, dc, y, x);
-		}
+		computeRow(dwellBuffer, cmin, dc, y, atX + omitBorder, xMax - omitBorder);
 	}
 }
 
-void fillBlock(std::vector<std::vector<int>> &dwellBuffer,
+void fillBlock(DwellBuffer &dwellBuffer,
 			   int const dwell,
 			   unsigned int const atY,
 			   unsigned int const atX,
 			   unsigned int const blockSize,
 			   unsigned int const omitBorder = 0)
 {
-	unsigned int const yMax = (res > atY + blockSize) ? atY + blockSize : res;
-	unsigned int const xMax = (res > atX + blockSize) ? atX + blockSize : res;
+	unsigned int const yMax = (imageHeight > atY + blockSize) ? atY + blockSize : imageHeight;
+	unsigned int const xMax = (imageWidth > atX + blockSize) ? atX + blockSize : imageWidth;
+	// Exterior blocks of the distance estimation get the lower bound of their distance
+	bool const exterior = dwellBuffer.hasDistance() && dwell < (int) maxDwell;
+	float const distance = fillDistance(blockSize);
+	unsigned long long filled = 0;
 	for (unsigned int y = atY + omitBorder; y < yMax - omitBorder; y++) {
 		for (unsigned int x = atX + omitBorder; x < xMax - omitBorder; x++) {
-			if (dwellBuffer.at(y).at(x) < 0) {
-				dwellBuffer.at(y).at(x) = dwell;
+			if (dwellBuffer.at(y, x) < 0) {
+				dwellBuffer.at(y, x) = dwell;
+				if (exterior) {
+					dwellBuffer.distance(y, x) = distance;
+				}
+				filled++;
+			}
+		}
+	}
+	threadStats.filled += filled;
+}
+
+
+/**
+* Computes the border of a block: the first and last row in full and the columns in between.
+*/
+void computeBorder(DwellBuffer &dwellBuffer,
+				   std::complex<double> const &cmin,
+				   std::complex<double> const &dc,
+				   unsigned int const atY,
+				   unsigned int const atX,
+				   unsigned int const blockSize)
+{
+	unsigned int const yMax = (imageHeight > atY + blockSize - 1) ? atY + blockSize - 1 : imageHeight - 1;
+	unsigned int const xMax = (imageWidth > atX + blockSize - 1) ? atX + blockSize - 1 : imageWidth - 1;
+	if (atY >= imageHeight || atX >= imageWidth) {
+		return;
+	}
+	unsigned long long const evaluated = threadStats.evaluated;
+	computeRow(dwellBuffer, cmin, dc, atY, atX, xMax + 1);
+	if (yMax != atY) {
+		computeRow(dwellBuffer, cmin, dc, yMax, atX, xMax + 1);
+	}
+	PixelBatch batch(dwellBuffer, cmin, dc);
+	for (unsigned int y = atY + 1; y < yMax; y++) {
+		batch.add(y, atX);
+		if (xMax != atX) {
+			batch.add(y, xMax);
+		}
+	}
+	batch.flush();
+	threadStats.border += threadStats.evaluated - evaluated;
+}
+
+/**
+* Computes the lines a block gets split along before it is subdivided: the last row and column
+* of every child but the last and the first row and column of every child but the first one.
+* The outer edges of the children are the border of the block itself, so together with these
+* cross lines every child inherits a fully computed border and no pixel is evaluated twice.
+* Rows are computed as contiguous runs, columns skip the crossings already done by the rows.
+*/
+void computeCrossLines(DwellBuffer &dwellBuffer,
+					   std::complex<double> const &cmin,
+					   std::complex<double> const &dc,
+					   unsigned int const atY,
+					   unsigned int const atX,
+					   unsigned int const blockSize,
+					   unsigned int const split)
+{
+	unsigned int const yMax = (imageHeight > atY + blockSize - 1) ? atY + blockSize - 1 : imageHeight - 1;
+	unsigned int const xMax = (imageWidth > atX + blockSize - 1) ? atX + blockSize - 1 : imageWidth - 1;
+	unsigned int const newBlockSize = blockSize / split;
+	if (atY >= imageHeight || atX >= imageWidth) {
+		return;
+	}
+	unsigned long long const evaluated = threadStats.evaluated;
+	// With a child size of 1 neighbouring lines coincide
+	unsigned int last = atY;
+	for (unsigned int div = 1; div < split; div++) {
+		for (unsigned int y = atY + div * newBlockSize - 1; y <= atY + div * newBlockSize; y++) {
+			if (y > last && y < yMax) {
+				computeRow(dwellBuffer, cmin, dc, y, atX + 1, xMax);
+				last = y;
+			}
+		}
+	}
+	// Gathered in batches row by row, so the crossings with the rows above are skipped
+	PixelBatch batch(dwellBuffer, cmin, dc);
+	for (unsigned int y = atY + 1; y < yMax && atX + 1 < xMax; y++) {
+		if (dwellBuffer.at(y, atX + 1) >= 0) {
+			continue;
+		}
+		last = atX;
+		for (unsigned int div = 1; div < split; div++) {
+			for (unsigned int x = atX + div * newBlockSize - 1; x <= atX + div * newBlockSize; x++) {
+				if (x > last && x < xMax) {
+					batch.add(y, x);
+					last = x;
+				}
 			}
 		}
 	}
+	batch.flush();
+	threadStats.border += threadStats.evaluated - evaluated;
 }
 
+/**
+* Split of a block whose border is not common for the adaptive subdivision, 0 to compute it.
+* The dwell changes along the border estimate how much structure runs through the block:
+* a quiet border means a few features in mostly flat area, split 2x2 to fill it as fine as
+* possible. A busy border means filaments everywhere, the children would fail the border test
+* again, so small blocks are computed right away and large ones skip a level by splitting 4x4.
+* The border is known already at this point, so the decision costs no evaluations.
+*/
+unsigned int adaptiveSplit(DwellBuffer const &dwellBuffer,
+						   unsigned int const atY,
+						   unsigned int const atX,
+						   unsigned int const blockSize)
+{
+	if (blockSize < 2 * blockDim) {
+		return 0;
+	}
+	unsigned int const yMax = (imageHeight > atY + blockSize - 1) ? atY + blockSize - 1 : imageHeight - 1;
+	unsigned int const xMax = (imageWidth > atX + blockSize - 1) ? atX + blockSize - 1 : imageWidth - 1;
+	// Walk around the border clockwise, counting the neighbours of different dwell
+	unsigned int changes = 0, length = 0;
+	int previous = dwellBuffer.at(atY, atX);
+	auto visit = [&](unsigned int const y, unsigned int const x) {
+		int const dwell = dwellBuffer.at(y, x);
+		changes += dwell != previous;
+		previous = dwell;
+		length++;
+	};
+	for (unsigned int x = atX + 1; x <= xMax; x++) visit(atY, x);
+	for (unsigned int y = atY + 1; y <= yMax; y++) visit(y, xMax);
+	for (unsigned int x = xMax; x-- > atX;) visit(yMax, x);
+	for (unsigned int y = yMax; y-- > atY;) visit(y, atX);
+	bool const busy = changes >= adaptiveBusy * length;
+	if (!busy) {
+		return 2;
+	}
+	if (blockSize <= adaptiveComputeBlocks * blockDim) {
+		return 0;
+	}
+	return blockSize >= 4 * blockDim ? 4 : 2;
+}
 
 // define job data type here
 typedef struct job {
-   std::vector<std::vector<int>> &dwellBuffer;
+   DwellBuffer &dwellBuffer;
    int dwell;
    unsigned int atY;
    unsigned int atX;
@@ -310,34 +1232,53 @@ atomic<int> counter(0), limit(0);
 
 void addWork(job task)
 {
-	unique_lock<mutex> lck(mutexVariable2);
+	unique_lock<mutex> lck(mutexVariable2, std::defer_lock);
+	{
+		TraceSpan span("lock");
+		lck.lock();
+	}
 	queue.push_back(task);
+	threadStats.pushes++;
 	myCv.notify_all();
 }
 
 // Original version of marianiSilver algorithm
-void marianiSilverOriginal( std::vector<std::vector<int>> &dwellBuffer,
+void marianiSilverOriginal( DwellBuffer &dwellBuffer,
 					std::complex<double> const &cmin,
 					std::complex<double> const &dc,
 					unsigned int const atY,
 					unsigned int const atX,
 					unsigned int const blockSize)
 {
-	int dwell = commonBorder(dwellBuffer, cmin, dc, atY, atX, blockSize);
+	unsigned long long const iterations = threadStats.iterations;
+	int dwell;
+	{
+		StatsTimer timer(threadStats.borderTime);
+		dwell = commonBorder(dwellBuffer, cmin, dc, atY, atX, blockSize);
+	}
+	threadStats.decisions[(dwell >= 0) ? 0 : (blockSize <= blockDim) ? 1 : (subDiv == 2) ? 2 : 3]++;
 	if ( dwell >= 0 ) {
+		StatsTimer timer(threadStats.fillTime);
 		fillBlock(dwellBuffer, dwell, atY, atX, blockSize);
 		if (mark) {
 					markBorder(dwellBuffer, dwellFill, atY, atX, blockSize);
 		}
+		recordBlock(atY, atX, blockSize, HeatDecision::Fill, threadStats.iterations - iterations);
 	} else if (blockSize <= blockDim) {
+		StatsTimer timer(threadStats.computeTime);
 		computeBlock(dwellBuffer, cmin, dc, atY, atX, blockSize);
 		if (mark)
 			markBorder(dwellBuffer, dwellCompute, atY, atX, blockSize);
+		recordBlock(atY, atX, blockSize, HeatDecision::Compute, threadStats.iterations - iterations);
 	} else {
+		recordBlock(atY, atX, blockSize, HeatDecision::Split, threadStats.iterations - iterations);
 		// Subdivision
 		unsigned int newBlockSize = blockSize / subDiv;
 		for (unsigned int ydiv = 0; ydiv < subDiv; ydiv++) {
 			for (unsigned int xdiv = 0; xdiv < subDiv; xdiv++) {
+				if (atY + ydiv * newBlockSize >= imageHeight || atX + xdiv * newBlockSize >= imageWidth) {
+					continue;
+				}
 				marianiSilverOriginal(dwellBuffer, cmin, dc, atY + (ydiv * newBlockSize), atX + (xdiv * newBlockSize), newBlockSize);
 			}
 		}
@@ -347,7 +1288,7 @@ void marianiSilverOriginal( std::vector<std::vector<int>> &dwellBuffer,
 /**
 * Task 1b: computation of the dwell is parallelized.
 */
-void marianiSilverWithThreadedCommonBorder( std::vector<std::vector<int>> &dwellBuffer,
+void marianiSilverWithThreadedCommonBorder( DwellBuffer &dwellBuffer,
 					std::complex<double> const &cmin,
 					std::complex<double> const &dc,
 					unsigned int const atY,
@@ -378,29 +1319,47 @@ void marianiSilverWithThreadedCommonBorder( std::vector<std::vector<int>> &dwell
 /**
 * Task 1c: parallelized version with recursion
 */
-void marianiSilver( std::vector<std::vector<int>> &dwellBuffer,
+void marianiSilver( DwellBuffer &dwellBuffer,
 					std::complex<double> const &cmin,
 					std::complex<double> const &dc,
 					unsigned int const atY,
 					unsigned int const atX,
 					unsigned int const blockSize)
 {
-	int dwell = commonBorder(dwellBuffer, cmin, dc, atY, atX, blockSize);
+	unsigned long long const iterations = threadStats.iterations;
+	int dwell;
+	{
+		StatsTimer timer(threadStats.borderTime);
+		dwell = commonBorder(dwellBuffer, cmin, dc, atY, atX, blockSize);
+	}
+	threadStats.decisions[(dwell >= 0) ? 0 : (blockSize <= blockDim) ? 1 : (subDiv == 2) ? 2 : 3]++;
 	if ( dwell >= 0 ) {
+		StatsTimer timer(threadStats.fillTime);
 		fillBlock(dwellBuffer, dwell, atY, atX, blockSize);
 		if (mark) {
 					markBorder(dwellBuffer, dwellFill, atY, atX, blockSize);
 		}
+		recordBlock(atY, atX, blockSize, HeatDecision::Fill, threadStats.iterations - iterations);
 	} else if (blockSize <= blockDim) {
+		StatsTimer timer(threadStats.computeTime);
 		computeBlock(dwellBuffer, cmin, dc, atY, atX, blockSize);
 		if (mark)
 			markBorder(dwellBuffer, dwellCompute, atY, atX, blockSize);
+		recordBlock(atY, atX, blockSize, HeatDecision::Compute, threadStats.iterations - iterations);
 	} else {
+		recordBlock(atY, atX, blockSize, HeatDecision::Split, threadStats.iterations - iterations);
 		// Subdivision
 		unsigned int newBlockSize = blockSize / subDiv;
 		vector<thread> threads;
 		for (unsigned int ydiv = 0; ydiv < subDiv; ydiv++) {
 			for (unsigned int xdiv = 0; xdiv < subDiv; xdiv++) {
+				if (atY + ydiv * newBlockSize >= imageHeight || atX + xdiv * newBlockSize >= imageWidth) {
+					continue;
+				}
+				if (newBlockSize < recursiveThreadBlock) {
+					marianiSilver(dwellBuffer, cmin, dc, atY + (ydiv * newBlockSize), atX + (xdiv * newBlockSize), newBlockSize);
+					continue;
+				}
 				threads.push_back(
 					thread(
 						marianiSilver,
@@ -420,37 +1379,63 @@ void marianiSilver( std::vector<std::vector<int>> &dwellBuffer,
 			threads.at(i).join();
 		}
 	}
+	publishStats(-1);
 }
 
 /**
 * Task 2
 * Instead of calling recursively the marianiSilver, we add a job into the queue.
 */
-void marianiSilverJob( std::vector<std::vector<int>> &dwellBuffer,
+void marianiSilverJob( DwellBuffer &dwellBuffer,
 					std::complex<double> const &cmin,
 					std::complex<double> const &dc,
 					unsigned int const atY,
 					unsigned int const atX,
 					unsigned int const blockSize)
 {
-
-	int dwell = commonBorder(dwellBuffer, cmin, dc, atY, atX, blockSize);
+	unsigned long long const iterations = threadStats.iterations;
+	int dwell;
+	unsigned int split;
+	{
+		StatsTimer timer(threadStats.borderTime);
+		dwell = commonBorder(dwellBuffer, cmin, dc, atY, atX, blockSize);
+		// Split factor of the block, 0 if it is computed
+		split = (dwell >= 0) ? 0
+			  : (adaptive) ? adaptiveSplit(dwellBuffer, atY, atX, blockSize)
+			  : (blockSize <= blockDim) ? 0 : subDiv;
+	}
+	threadStats.decisions[(dwell >= 0) ? 0 : (split == 0) ? 1 : (split == 2) ? 2 : 3]++;
 	if ( dwell >= 0 ) {
+		StatsTimer timer(threadStats.fillTime);
 		fillBlock(dwellBuffer, dwell, atY, atX, blockSize);
 		if (mark) {
 					markBorder(dwellBuffer, dwellFill, atY, atX, blockSize);
 		}
-	} else if (blockSize <= blockDim) {
-		computeBlock(dwellBuffer, cmin, dc, atY, atX, blockSize);
+		recordBlock(atY, atX, blockSize, HeatDecision::Fill, threadStats.iterations - iterations);
+	} else if (split == 0) {
+		StatsTimer timer(threadStats.computeTime);
+		// The border is known already, either from render() or from the cross lines of the parent
+		computeBlock(dwellBuffer, cmin, dc, atY, atX, blockSize, 1);
 		if (mark)
 			markBorder(dwellBuffer, dwellCompute, atY, atX, blockSize);
+		recordBlock(atY, atX, blockSize, HeatDecision::Compute, threadStats.iterations - iterations);
 	} else {
-		// Update the total number of job to execute
-		limit += subDiv * subDiv;
-		// Subdivision
-		unsigned int newBlockSize = blockSize / subDiv;
-		for (unsigned int ydiv = 0; ydiv < subDiv; ydiv++) {
-			for (unsigned int xdiv = 0; xdiv < subDiv; xdiv++) {
+		// The children only have to compare their borders
+		{
+			StatsTimer timer(threadStats.subdivisionTime);
+			computeCrossLines(dwellBuffer, cmin, dc, atY, atX, blockSize, split);
+		}
+		recordBlock(atY, atX, blockSize, HeatDecision::Split, threadStats.iterations - iterations);
+		// Subdivision
+		unsigned int newBlockSize = blockSize / split;
+		for (unsigned int ydiv = 0; ydiv < split; ydiv++) {
+			for (unsigned int xdiv = 0; xdiv < split; xdiv++) {
+				// Children of clipped blocks may lie completely outside of the image
+				if (atY + ydiv * newBlockSize >= imageHeight || atX + xdiv * newBlockSize >= imageWidth) {
+					continue;
+				}
+				// Update the total number of job to execute
+				limit++;
 				addWork(
 					job{
 						dwellBuffer,
@@ -461,84 +1446,1753 @@ void marianiSilverJob( std::vector<std::vector<int>> &dwellBuffer,
 						dc,
 						cmin
 					}
-				);
+				);
+			}
+		}
+	}
+}
+
+void help() {
+	std::cout << "Mandelbrot Set Renderer" << std::endl;
+	std::cout << std::endl;
+	std::cout << "\t" << "-x [0;1]" << "\t" << "Center of Re[-1.5;0.5] (default=0.5)" << std::endl;
+	std::cout << "\t" << "-y [0;1]" << "\t" << "Center of Im[-1;1] (default=0.5)" << std::endl;
+	std::cout << "\t" << "-s (0;1]" << "\t" << "Inverse scaling factor (default=1)" << std::endl;
+	std::cout << "\t" << "-r [pixel]" << "\t" << "Image resolution, sets width and height (default=1024)" << std::endl;
+	std::cout << "\t" << "-i [iterations]" << "\t" << "Iterations or max dwell (default=512)" << std::endl;
+	std::cout << "\t" << "-c [colours]" << "\t" << "colour map iterations (default=1)" << std::endl;
+	std::cout << "\t" << "-b [block dim]" << "\t" << "min block dimension for subdivision (default=16)" << std::endl;
+	std::cout << "\t" << "-d [subdivison]" << "\t" << "subdivision of blocks (default=4)" << std::endl;
+	std::cout << "\t" << "-m" << "\t" << "mark Mariani-Silver borders" << std::endl;
+	std::cout << "\t" << "-t" << "\t" << "traditional computation (no Mariani-Silver)" << std::endl;
+	std::cout << "\t" << "--png-level=[level]" << "\t" << "PNG encoder profile store|fast|default|max (default=default)" << std::endl;
+	std::cout << "\t" << "--dwell=[file]" << "\t" << "also write the raw dwell buffer to a memory mapped file" << std::endl;
+	std::cout << "\t" << "--save-dwell" << "\t" << "write the raw dwell buffer next to the output (.dwell)" << std::endl;
+	std::cout << "\t" << "--recolour=[file]" << "\t" << "colour and encode a dwell file instead of rendering" << std::endl;
+	std::cout << "\t" << "--smooth" << "\t" << "smooth colouring from the fractional dwell" << std::endl;
+	std::cout << "\t" << "--histogram" << "\t" << "histogram equalized colouring (ignores -c and --smooth)" << std::endl;
+	std::cout << "\t" << "--distance" << "\t" << "line art from the exterior distance estimation" << std::endl;
+	std::cout << "\t" << "--interior" << "\t" << "stop iterating orbits caught by an attracting cycle" << std::endl;
+	std::cout << "\t" << "--aa[=grid]" << "\t" << "supersample edge pixels with grid x grid jittered samples (default=3)" << std::endl;
+	std::cout << "\t" << "--aa-threshold=[dwell]" << "\t" << "dwell difference to a neighbour that makes an edge (default=0)" << std::endl;
+	std::cout << "\t" << "--adaptive" << "\t" << "choose 2x2, 4x4 or computing per block from its border (ignores -d)" << std::endl;
+	std::cout << "\t" << "--engine=[engine]" << "\t" << "serial|recursive|queue|traditional (default=queue, -t=traditional)" << std::endl;
+	std::cout << "\t" << "--threads=[n]" << "\t" << "threads of the queue and traditional engines (default=0, one per core)" << std::endl;
+	std::cout << "\t" << "--bench[=file]" << "\t" << "run the benchmark sweep and write it as CSV or .json (default=bench.csv)" << std::endl;
+	std::cout << "\t" << "--bench-trials=[n]" << "\t" << "timed runs per benchmark configuration (default=5)" << std::endl;
+	std::cout << "\t" << "--prepass[=file]" << "\t" << "order and split the work by a 1/16 resolution cost map, also write it as preview image" << std::endl;
+	std::cout << "\t" << "--progressive[=-]" << "\t" << "escape time render from 1/8 over 1/4 and 1/2 to full resolution, levels as output-8.png ... or PPM frames to stdout (-)" << std::endl;
+	std::cout << "\t" << "--tiles=[dir]" << "\t" << "render the view as XYZ pyramid of 256x256 tiles dir/z/x/y.png" << std::endl;
+	std::cout << "\t" << "--tile-levels=[n]" << "\t" << "zoom levels of the tile pyramid (default=4, max=20)" << std::endl;
+	std::cout << "\t" << "--verify" << "\t" << "compare all engines, kernels and subdivisions against the escape time render" << std::endl;
+	std::cout << "\t" << "--stats[=file]" << "\t" << "print phase times and render counters, also as JSON to file" << std::endl;
+	std::cout << "\t" << "--trace=[file]" << "\t" << "write a Chrome trace (chrome://tracing, Perfetto) of the threads" << std::endl;
+	std::cout << "\t" << "--heatmap[=file]" << "\t" << "write the iterations per pixel and the block decisions as image and .csv (default=output-heatmap.png)" << std::endl;
+	std::cout << "\t" << "--width=[pixel]" << "\t" << "image width, the view extends along the longer side (default=-r)" << std::endl;
+	std::cout << "\t" << "--height=[pixel]" << "\t" << "image height, the view extends along the longer side (default=-r)" << std::endl;
+}
+
+// Multiple thread version for task 2c
+// counter is the number of finished jobs and limit the number of created jobs. A job adds
+// its children to limit before it finishes, so counter == limit means all the work is done.
+void worker(unsigned int const slot) {
+	traceThread("worker " + std::to_string(slot));
+	// Acquire the lock on mutexVariable2
+	unique_lock<mutex> lck(mutexVariable2, std::defer_lock);
+	{
+		TraceSpan span("lock");
+		lck.lock();
+	}
+	while(true) {
+		// If the queue is empty wait until a new job is available or everything is done
+		{
+			StatsTimer idle(threadStats.idle);
+			while(queue.empty() && counter < limit) {
+				TraceSpan span("wait");
+				myCv.wait(lck);
+			}
+		}
+		if(queue.empty()) {
+			break;
+		}
+		job currentTask = queue.front();
+		queue.pop_front();
+		threadStats.pops++;
+		// Execute the actual work without holding the lock
+		lck.unlock();
+		{
+			StatsTimer busy(threadStats.busy);
+			TraceSpan span("job", currentTask.atY, currentTask.atX, currentTask.blockSize);
+			marianiSilverJob(currentTask.dwellBuffer, currentTask.cmin, currentTask.dc, currentTask.atY, currentTask.atX, currentTask.blockSize);
+		}
+		{
+			TraceSpan span("lock");
+			lck.lock();
+		}
+		// Wake up the waiting workers so they can terminate
+		if(++counter == limit) {
+			myCv.notify_all();
+		}
+	}
+	lck.unlock();
+	publishStats(slot);
+}
+
+// Single thread worker function for task 2a
+void workerWithoutThread(void){
+	while(!queue.empty()){
+		job currentTask = queue.front();
+		queue.pop_front();
+		marianiSilverJob(currentTask.dwellBuffer, currentTask.cmin, currentTask.dc, currentTask.atY, currentTask.atX, currentTask.blockSize);
+	}
+}
+
+// Render engines: the task variants of the Mariani-Silver algorithm and the escape time one
+enum class Engine { Serial, Recursive, Queue, Traditional };
+
+bool parseEngine(std::string const &name, Engine &engine) {
+	if (name == "serial") engine = Engine::Serial;
+	else if (name == "recursive") engine = Engine::Recursive;
+	else if (name == "queue") engine = Engine::Queue;
+	else if (name == "traditional") engine = Engine::Traditional;
+	else return false;
+	return true;
+}
+
+char const *engineName(Engine const engine) {
+	switch (engine) {
+		case Engine::Serial: return "serial";
+		case Engine::Recursive: return "recursive";
+		case Engine::Queue: return "queue";
+		case Engine::Traditional: return "traditional";
+	}
+	return "unknown";
+}
+
+// Upper limit of the root block size, 0 for none. Tiles of a distributed render are single roots
+static unsigned int rootLimit = 0;
+
+// Pixels per side of a cell of the --prepass cost map, the dwell of one pixel is sampled per cell
+static constexpr const unsigned int costCell = 16;
+// Root blocks estimated to hold more than this share of the work of a thread are split before queueing
+static constexpr const double prepassHeavyShare = 0.25;
+static bool prepass = false;
+// Dwell of the centre pixel of every cell, row major: the cost map and a low resolution preview
+static std::vector<int> costMap;
+static unsigned int costColumns = 0;
+static unsigned int costRows = 0;
+
+/**
+* Low resolution pre-pass: samples the dwell of the centre pixel of every costCell x costCell
+* cell of the image into costMap, which costs 1/costCell^2 of a traditional render.
+*/
+void buildCostMap(std::complex<double> const &cmin, std::complex<double> const &dc) {
+	TraceSpan span("prepass");
+	costColumns = (imageWidth + costCell - 1) / costCell;
+	costRows = (imageHeight + costCell - 1) / costCell;
+	costMap.assign((size_t) costColumns * costRows, 0);
+	parallelRows(costRows, [&](unsigned int const begin, unsigned int const end) {
+		for (unsigned int row = begin; row < end; row++) {
+			double const y = std::min(row * costCell + costCell / 2, imageHeight - 1);
+			for (unsigned int column = 0; column < costColumns; column++) {
+				double const x = std::min(column * costCell + costCell / 2, imageWidth - 1);
+				costMap[(size_t) row * costColumns + column] = interiorDetection ? pixelDwell<false, true>(cmin, dc, y, x, nullptr)
+																				 : pixelDwell<false, false>(cmin, dc, y, x, nullptr);
+			}
+		}
+	});
+}
+
+// Estimated iterations of a region from the cost map cells it touches, interior cells count maxDwell
+unsigned long long regionCost(unsigned int const atY, unsigned int const atX, unsigned int const height, unsigned int const width) {
+	unsigned int const rowEnd = std::min((std::min(atY + height, imageHeight) + costCell - 1) / costCell, costRows);
+	unsigned int const columnEnd = std::min((std::min(atX + width, imageWidth) + costCell - 1) / costCell, costColumns);
+	unsigned long long cost = 0;
+	for (unsigned int row = atY / costCell; row < rowEnd; row++) {
+		for (unsigned int column = atX / costCell; column < columnEnd; column++) {
+			cost += std::min((unsigned int) costMap[(size_t) row * costColumns + column], maxDwell);
+		}
+	}
+	return cost;
+}
+
+// Subdivision the root blocks are sized for, the adaptive subdivision halves or quarters blocks
+inline unsigned int rootDivision(Engine const engine) {
+	return (adaptive && engine == Engine::Queue) ? 2 : subDiv;
+}
+
+/**
+* Root block size of the Mariani-Silver tiling: the largest subdividable block size that fits
+* into the shorter side of the image and rootLimit.
+*/
+unsigned int rootBlockSize(Engine const engine) {
+	unsigned int const rootDiv = rootDivision(engine);
+	unsigned int const fit = (rootLimit) ? std::min(rootLimit, res) : res;
+	unsigned int size = blockDim;
+	while ((unsigned long long) size * rootDiv <= fit) {
+		size *= rootDiv;
+	}
+	return size;
+}
+
+/**
+* Renders the viewport into dwellBuffer, which has to be initialized with -1, using the given
+* engine. The job queue and the traditional algorithm run on NUM_THREAD threads (0 for one per
+* hardware thread), the serial engine on the calling one and the recursive engine spawns a thread
+* per child block.
+*/
+void render(DwellBuffer &dwellBuffer,
+			std::complex<double> const &cmin,
+			std::complex<double> const &dc,
+			Engine const engine,
+			unsigned int NUM_THREAD = 0)
+{
+	vector<thread> threads;
+	if (NUM_THREAD == 0) {
+		NUM_THREAD = std::max(1u, thread::hardware_concurrency());
+	}
+
+
+	statsTotal = RenderStats();
+	if (heatmap) {
+		heatCost.assign((size_t) imageWidth * imageHeight, heatCostFilled);
+		heatBlocks.clear();
+	}
+	statsThreads.assign((engine == Engine::Queue || engine == Engine::Traditional) ? NUM_THREAD : 0, RenderStats());
+	if (prepass) {
+		buildCostMap(cmin, dc);
+	}
+	if (engine != Engine::Traditional) {
+		unsigned int const rootSize = rootBlockSize(engine);
+		// Mariani-Silver subdivision algorithm
+		// The image is tiled with root blocks, the ones at the right and bottom edge are clipped.
+		for (unsigned int atY = 0; atY < imageHeight && engine != Engine::Queue; atY += rootSize) {
+			for (unsigned int atX = 0; atX < imageWidth; atX += rootSize) {
+				if (engine == Engine::Serial) {
+					//Call to the original implementation of mariani silver
+					marianiSilverOriginal(dwellBuffer, cmin, dc, atY, atX, rootSize);
+				} else {
+					//Call to the parallelized version of mariani silver
+					marianiSilver(dwellBuffer, cmin, dc, atY, atX, rootSize);
+				}
+			}
+		}
+		if (engine != Engine::Queue) {
+			publishStats(-1);
+			return;
+		}
+
+		struct Root {
+			unsigned int atY;
+			unsigned int atX;
+			unsigned int blockSize;
+			unsigned long long cost;
+		};
+		std::vector<Root> roots;
+		for (unsigned int atY = 0; atY < imageHeight; atY += rootSize) {
+			for (unsigned int atX = 0; atX < imageWidth; atX += rootSize) {
+				roots.push_back(Root{atY, atX, rootSize, 0});
+			}
+		}
+		if (prepass) {
+			// Heavy roots are split into smaller roots, so no thread ends up with one alone while the
+			// others run dry, and the most expensive roots are queued first
+			unsigned int const rootDiv = rootDivision(engine);
+			unsigned long long total = 0;
+			for (Root &root : roots) {
+				root.cost = regionCost(root.atY, root.atX, root.blockSize, root.blockSize);
+				total += root.cost;
+			}
+			double const heavy = prepassHeavyShare * total / NUM_THREAD;
+			for (size_t i = 0; i < roots.size(); i++) {
+				Root const root = roots[i];
+				if (root.cost <= heavy || root.blockSize / rootDiv < blockDim) {
+					continue;
+				}
+				unsigned int const childSize = root.blockSize / rootDiv;
+				roots[i].blockSize = childSize;
+				roots[i].cost = regionCost(root.atY, root.atX, childSize, childSize);
+				for (unsigned int ydiv = 0; ydiv < rootDiv; ydiv++) {
+					for (unsigned int xdiv = 0; xdiv < rootDiv; xdiv++) {
+						unsigned int const atY = root.atY + ydiv * childSize;
+						unsigned int const atX = root.atX + xdiv * childSize;
+						if ((ydiv || xdiv) && atY < imageHeight && atX < imageWidth) {
+							roots.push_back(Root{atY, atX, childSize, regionCost(atY, atX, childSize, childSize)});
+						}
+					}
+				}
+				// The first child takes the place of the root and may be heavy as well
+				i--;
+			}
+			std::stable_sort(roots.begin(), roots.end(), [](Root const &a, Root const &b) { return a.cost > b.cost; });
+		}
+
+		// Only the borders of the root blocks are computed here, every other block inherits its border
+		counter = 0;
+		limit = 0;
+		for (Root const &root : roots) {
+			{
+				StatsTimer timer(threadStats.subdivisionTime);
+				TraceSpan span("root border", root.atY, root.atX, root.blockSize);
+				computeBorder(dwellBuffer, cmin, dc, root.atY, root.atX, root.blockSize);
+			}
+			limit++;
+			addWork(job{dwellBuffer, 0, root.atY, root.atX, root.blockSize, dc, cmin});
+		}
+		publishStats(-1);
+
+		// Initialize the vector of threads and make them execute the worker function
+		for(unsigned int i=0;i<NUM_THREAD; i++) {
+			threads.push_back(
+				thread(
+					worker,
+					i
+				)
+			);
+		}
+
+		// Wait for all the thread to finish
+		for(unsigned int i=0;i<NUM_THREAD; i++) {
+			threads.at(i).join();
+		}
+	} else {
+		// Traditional Mandelbrot-Set computation or the 'Escape Time' algorithm.
+		//implementation is now threaded
+		// Initialize the vector of threads and make them execute the threadedComputeBlock function
+		// Every thread gets a strip of rows, the remainder of the division is spread over the strips.
+		// With --prepass the strips are cut at equal estimated cost instead of equal height.
+		std::vector<unsigned int> bounds(NUM_THREAD + 1);
+		for (unsigned int i = 0; i <= NUM_THREAD; i++) {
+			bounds[i] = (unsigned long long) imageHeight * i / NUM_THREAD;
+		}
+		if (prepass) {
+			std::vector<unsigned long long> rowCost(costRows);
+			unsigned long long total = 0;
+			for (unsigned int row = 0; row < costRows; row++) {
+				// Every row costs something, so no strip is cut arbitrarily long over escaping pixels
+				rowCost[row] = regionCost(row * costCell, 0, costCell, imageWidth) + 1;
+				total += rowCost[row] * std::min(costCell, imageHeight - row * costCell);
+			}
+			unsigned long long sum = 0;
+			unsigned int strip = 1;
+			for (unsigned int y = 0; y < imageHeight && strip < NUM_THREAD; y++) {
+				sum += rowCost[y / costCell];
+				while (strip < NUM_THREAD && sum * NUM_THREAD >= total * strip) {
+					bounds[strip++] = y + 1;
+				}
+			}
+		}
+		double wall = 0;
+		{
+			StatsTimer timer(wall);
+			for(unsigned int i=0;i<NUM_THREAD; i++) {
+				unsigned int const begin = bounds[i];
+				unsigned int const end = bounds[i + 1];
+				threads.push_back(
+					thread([&dwellBuffer, &cmin, &dc, i, begin, end]() {
+						traceThread("strip " + std::to_string(i));
+						{
+							StatsTimer busy(threadStats.busy);
+							TraceSpan span("strip");
+							threadedComputeBlock(dwellBuffer, cmin, dc, begin, 0, end - begin, 0);
+						}
+						publishStats(i);
+					})
+				);
+			}
+
+			// Wait for all the thread to finish
+			for(unsigned int i=0;i<NUM_THREAD; i++) {
+				threads.at(i).join();
+			}
+		}
+		// A strip thread waits from its end until the slowest one is done
+		for (RenderStats &stats : statsThreads) {
+			stats.idle = (collectStats) ? wall - stats.busy : 0.0;
+		}
+		statsTotal.idle = 0;
+		for (RenderStats const &stats : statsThreads) {
+			statsTotal.idle += stats.idle;
+		}
+
+		if (mark)
+			markBorder(dwellBuffer, dwellCompute, 0, 0, std::max(imageWidth, imageHeight));
+	}
+}
+
+static_assert(sizeof(rgba) == 4, "rgba has to be a packed RGBA pixel");
+
+// Colour of a single dwell value, see colourFrame
+inline rgba const &dwellColour(int const dwell) {
+	return (unsigned int) dwell < dwellColours.size() ? dwellColours[dwell] : markerColour(dwell);
+}
+
+// Colour of a single dwell value and its fraction, see colourFrameSmooth
+inline rgba const &smoothColour(int const dwell, float const fraction) {
+	if ((unsigned int) dwell + 1 >= dwellColours.size()) {
+		return dwellColour(dwell);
+	}
+	int const index = std::max(0, dwell * (int) smoothSteps - (int) (fraction * smoothSteps));
+	return smoothColours[index % smoothColours.size()];
+}
+
+// Grey level of a distance estimate in pixels, see colourFrameDistance
+inline rgba distanceColour(float const distance) {
+	unsigned char const grey = 255.0f * std::sqrt(std::min(distance / distanceSaturation, 1.0f));
+	return rgba(grey, grey, grey, 255);
+}
+
+/**
+* Maps the dwellBuffer to the RGBA frameBuffer, in parallel over row bands unless serial.
+*/
+void colourFrame(DwellBuffer const &dwellBuffer, std::vector<unsigned char> &frameBuffer, bool const serial = false) {
+	unsigned int const width = dwellBuffer.width();
+	unsigned int const lastDwell = dwellColours.size() - 1;
+	rgba const *lut = dwellColours.data();
+	parallelRows(dwellBuffer.height(), [&](unsigned int const begin, unsigned int const end) {
+		for (unsigned int y = begin; y < end; y++) {
+			int const *dwell = dwellBuffer.row(y);
+			unsigned char *pixel = frameBuffer.data() + (size_t) y * width * 4;
+			for (unsigned int x = 0; x < width; x++) {
+				// Markers and unset pixels fall outside of the table
+				rgba const &colour = (unsigned int) dwell[x] <= lastDwell ? lut[dwell[x]] : markerColour(dwell[x]);
+				std::memcpy(pixel + 4 * x, &colour, 4);
+			}
+		}
+	}, serial);
+}
+
+/**
+* Smooth colouring: the fraction plane of the buffer holds how far the continuous dwell of every
+* pixel lies below its integer dwell, which selects one of the smoothSteps blended colours between
+* dwell - 1 and dwell. Pixels that reached maxDwell keep the colour of the integer table.
+*/
+void colourFrameSmooth(DwellBuffer const &dwellBuffer, std::vector<unsigned char> &frameBuffer, bool const serial = false) {
+	float const *fraction = dwellBuffer.fractionData();
+	unsigned int const width = dwellBuffer.width();
+	unsigned int const lastDwell = dwellColours.size() - 1;
+	unsigned int const period = smoothColours.size();
+	rgba const *lut = dwellColours.data();
+	rgba const *smooth = smoothColours.data();
+	parallelRows(dwellBuffer.height(), [&](unsigned int const begin, unsigned int const end) {
+		std::vector<int> index(width);
+		for (unsigned int y = begin; y < end; y++) {
+			int const *dwell = dwellBuffer.row(y);
+			float const *frac = fraction + (size_t) y * width;
+			unsigned char *pixel = frameBuffer.data() + (size_t) y * width * 4;
+			// Branch free index computation, vectorized by the compiler
+			for (unsigned int x = 0; x < width; x++) {
+				index[x] = std::max(0, dwell[x] * (int) smoothSteps - (int) (frac[x] * smoothSteps));
+			}
+			for (unsigned int x = 0; x < width; x++) {
+				rgba const &colour = (unsigned int) dwell[x] < lastDwell ? smooth[index[x] % period]
+									 : (unsigned int) dwell[x] == lastDwell ? lut[lastDwell] : markerColour(dwell[x]);
+				std::memcpy(pixel + 4 * x, &colour, 4);
+			}
+		}
+	}, serial);
+}
+
+/**
+* Line art from the distance estimation: the set and its boundary are black and the exterior
+* fades to white within distanceSaturation pixels.
+*/
+void colourFrameDistance(DwellBuffer const &dwellBuffer, std::vector<unsigned char> &frameBuffer, bool const serial = false) {
+	unsigned int const width = dwellBuffer.width();
+	parallelRows(dwellBuffer.height(), [&](unsigned int const begin, unsigned int const end) {
+		for (unsigned int y = begin; y < end; y++) {
+			int const *dwell = dwellBuffer.row(y);
+			float const *distance = dwellBuffer.distanceRow(y);
+			unsigned char *pixel = frameBuffer.data() + (size_t) y * width * 4;
+			for (unsigned int x = 0; x < width; x++) {
+				if ((unsigned int) dwell[x] > maxDwell) {
+					std::memcpy(pixel + 4 * x, &markerColour(dwell[x]), 4);
+					continue;
+				}
+				rgba const colour = distanceColour(distance[x]);
+				std::memcpy(pixel + 4 * x, &colour, 4);
+			}
+		}
+	}, serial);
+}
+
+// Colour of a single sample at the pixel coordinates (y, x), in the mode of the dwellBuffer
+rgba sampleColour(DwellBuffer const &dwellBuffer,
+				  std::complex<double> const &cmin,
+				  std::complex<double> const &dc,
+				  double const y,
+				  double const x)
+{
+	if (dwellBuffer.hasDistance()) {
+		float distance;
+		pixelDistance(cmin, dc, y, x, &distance);
+		return distanceColour(distance);
+	}
+	if (dwellBuffer.hasFraction()) {
+		float fraction;
+		int const dwell = interiorDetection ? pixelDwell<true, true>(cmin, dc, y, x, &fraction)
+											: pixelDwell<true, false>(cmin, dc, y, x, &fraction);
+		rgba const &colour = smoothColour(dwell, fraction);
+		return rgba(colour.r, colour.g, colour.b, colour.a);
+	}
+	int const dwell = interiorDetection ? pixelDwell<false, true>(cmin, dc, y, x, nullptr)
+										: pixelDwell<false, false>(cmin, dc, y, x, nullptr);
+	rgba const &colour = dwellColour(dwell);
+	return rgba(colour.r, colour.g, colour.b, colour.a);
+}
+
+// Deterministic pseudo random value in [0;1) for the jitter of a sample
+inline double jitter(unsigned int const y, unsigned int const x, unsigned int const sample) {
+	uint32_t h = y * 0x9E3779B1u ^ x * 0x85EBCA77u ^ sample * 0xC2B2AE3Du;
+	h ^= h >> 15;
+	h *= 0x2C1B3C6Du;
+	h ^= h >> 12;
+	return (h >> 8) * (1.0 / (1 << 24));
+}
+
+/**
+* Adaptive antialiasing on top of a coloured frame. Only pixels whose dwell differs from one of
+* their four neighbours by more than threshold are supersampled, with grid x grid jittered
+* samples averaged with the pixel itself. Blocks filled by Mariani-Silver are uniform, so only
+* their edges are considered and the cost scales with the length of the boundaries, not the area.
+* Returns the number of supersampled pixels.
+*/
+unsigned long long antialiasFrame(DwellBuffer const &dwellBuffer,
+								  std::complex<double> const &cmin,
+								  std::complex<double> const &dc,
+								  unsigned int const grid,
+								  unsigned int const threshold,
+								  std::vector<unsigned char> &frameBuffer)
+{
+	unsigned int const width = dwellBuffer.width();
+	unsigned int const height = dwellBuffer.height();
+	std::atomic<unsigned long long> supersampled(0);
+	// The interior marker counts as maxDwell, the border markers of -m are never sampled
+	auto dwellAt = [&](unsigned int const y, unsigned int const x) {
+		int const dwell = dwellBuffer.at(y, x);
+		return isInterior(dwell) ? (int) maxDwell : dwell;
+	};
+	auto differs = [&](int const dwell, unsigned int const y, unsigned int const x) {
+		int const other = dwellAt(y, x);
+		return other <= (int) maxDwell && (unsigned int) std::abs(other - dwell) > threshold;
+	};
+	parallelRows(height, [&](unsigned int const begin, unsigned int const end) {
+		unsigned long long count = 0;
+		for (unsigned int y = begin; y < end; y++) {
+			for (unsigned int x = 0; x < width; x++) {
+				int const dwell = dwellAt(y, x);
+				if (dwell < 0 || dwell > (int) maxDwell) {
+					continue;
+				}
+				if (!((x > 0 && differs(dwell, y, x - 1)) || (x + 1 < width && differs(dwell, y, x + 1)) ||
+					  (y > 0 && differs(dwell, y - 1, x)) || (y + 1 < height && differs(dwell, y + 1, x)))) {
+					continue;
+				}
+				unsigned char *pixel = frameBuffer.data() + ((size_t) y * width + x) * 4;
+				unsigned int r = pixel[0], g = pixel[1], b = pixel[2];
+				for (unsigned int sy = 0; sy < grid; sy++) {
+					for (unsigned int sx = 0; sx < grid; sx++) {
+						unsigned int const sample = sy * grid + sx;
+						// Stratified: one sample in every cell of a grid x grid raster over the pixel
+						double const oy = (sy + jitter(y, x, 2 * sample)) / grid - 0.5;
+						double const ox = (sx + jitter(y, x, 2 * sample + 1)) / grid - 0.5;
+						rgba const colour = sampleColour(dwellBuffer, cmin, dc, y + oy, x + ox);
+						r += colour.r;
+						g += colour.g;
+						b += colour.b;
+					}
+				}
+				unsigned int const samples = grid * grid + 1;
+				pixel[0] = (r + samples / 2) / samples;
+				pixel[1] = (g + samples / 2) / samples;
+				pixel[2] = (b + samples / 2) / samples;
+				count++;
+			}
+		}
+		supersampled += count;
+	});
+	return supersampled;
+}
+
+// Path of a file saved next to another one: its extension is replaced by suffix
+std::string pathWithSuffix(std::string const &path, std::string const &suffix) {
+	size_t const dot = path.rfind('.');
+	size_t const slash = path.rfind('/');
+	if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+		return path.substr(0, dot) + suffix;
+	}
+	return path + suffix;
+}
+
+// Path of the dwell file saved next to a PNG: the extension is replaced by .dwell
+std::string dwellPathFor(std::string const &imagePath) {
+	return pathWithSuffix(imagePath, ".dwell");
+}
+
+/**
+* Colours dwellBuffer with the colouring that matches its planes: distance line art, smooth or
+* integer dwell colours, with histogram equalization of the integer colours if requested.
+* serial colours on the calling thread, for callers that are already one of many workers.
+*/
+void colourBuffer(DwellBuffer const &dwellBuffer, bool const histogram, std::vector<unsigned char> &frameBuffer, bool const serial = false) {
+	if (dwellBuffer.hasDistance()) {
+		colourFrameDistance(dwellBuffer, frameBuffer, serial);
+	} else if (histogram) {
+		equalizeColourTable(dwellBuffer);
+		colourFrame(dwellBuffer, frameBuffer, serial);
+	} else if (dwellBuffer.hasFraction()) {
+		colourFrameSmooth(dwellBuffer, frameBuffer, serial);
+	} else {
+		colourFrame(dwellBuffer, frameBuffer, serial);
+	}
+}
+
+// Sample steps of the progressive levels before the full resolution, from the coarsest
+static unsigned int const progressiveSteps[] = { 8, 4, 2 };
+
+/**
+* Computes the pixels on the lattice of every step-th row and column that no coarser level
+* computed, i.e. all of them for the coarsest level and otherwise those off the lattice of
+* twice the step. The full resolution is step 1.
+*/
+void renderLevel(DwellBuffer &dwellBuffer,
+				 std::complex<double> const &cmin,
+				 std::complex<double> const &dc,
+				 unsigned int const step,
+				 bool const coarsest)
+{
+	parallelRows((imageHeight + step - 1) / step, [&](unsigned int const begin, unsigned int const end) {
+		{
+			PixelBatch batch(dwellBuffer, cmin, dc);
+			for (unsigned int row = begin; row < end; row++) {
+				unsigned int const y = row * step;
+				// Every other sample of the rows of the coarser lattice is known already
+				bool const known = !coarsest && y % (2 * step) == 0;
+				for (unsigned int x = (known) ? step : 0; x < imageWidth; x += (known) ? 2 * step : step) {
+					batch.add(y, x);
+				}
+			}
+		}
+		publishStats(-1);
+	});
+}
+
+// The samples of the lattice of the given step as a buffer of their own, with the same planes
+DwellBuffer levelSamples(DwellBuffer const &dwellBuffer, unsigned int const step) {
+	unsigned int const width = (dwellBuffer.width() + step - 1) / step;
+	unsigned int const height = (dwellBuffer.height() + step - 1) / step;
+	DwellBuffer level(width, height, -1, dwellBuffer.hasFraction(), dwellBuffer.hasDistance());
+	for (unsigned int y = 0; y < height; y++) {
+		for (unsigned int x = 0; x < width; x++) {
+			size_t const at = (size_t) y * step * dwellBuffer.width() + (size_t) x * step;
+			level.at(y, x) = dwellBuffer.at(y * step, x * step);
+			if (level.hasFraction()) {
+				level.fraction(y, x) = dwellBuffer.fractionData()[at];
+			}
+			if (level.hasDistance()) {
+				level.distance(y, x) = dwellBuffer.distanceRow(y * step)[x * step];
+			}
+		}
+	}
+	return level;
+}
+
+// Writes an RGBA framebuffer as a binary PPM (P6) frame, the alpha channel is dropped
+void writePpm(std::ostream &out, std::vector<unsigned char> const &frameBuffer, unsigned int const w, unsigned int const h) {
+	out << "P6\n" << w << " " << h << "\n255\n";
+	std::vector<char> row((size_t) w * 3);
+	for (unsigned int y = 0; y < h; y++) {
+		unsigned char const *pixel = frameBuffer.data() + (size_t) y * w * 4;
+		for (unsigned int x = 0; x < w; x++) {
+			row[3 * x] = pixel[4 * x];
+			row[3 * x + 1] = pixel[4 * x + 1];
+			row[3 * x + 2] = pixel[4 * x + 2];
+		}
+		out.write(row.data(), row.size());
+	}
+	out.flush();
+}
+
+/**
+* Progressive render: computes the escape time lattices of progressiveSteps from coarse to fine
+* and then the remaining pixels, every pixel exactly once. After every level its samples are
+* coloured at the level's resolution and written as PNG next to output (output-8.png, ...) or,
+* if stream is set, as PPM frame to stdout, and not written at all if output is empty. The colour
+* tables have to be created already, the full resolution is coloured by the caller. Returns the
+* error of the last PNG written.
+*/
+unsigned int renderProgressive(DwellBuffer &dwellBuffer,
+							   std::complex<double> const &cmin,
+							   std::complex<double> const &dc,
+							   bool const histogram,
+							   std::string const &output,
+							   bool const stream,
+							   png::Level const pngLevel,
+							   std::vector<double> &latencies)
+{
+	auto const start = std::chrono::steady_clock::now();
+	statsTotal = RenderStats();
+	if (heatmap) {
+		heatCost.assign((size_t) imageWidth * imageHeight, heatCostFilled);
+		heatBlocks.clear();
+	}
+	for (unsigned int const step : progressiveSteps) {
+		TraceSpan span("level", 0, 0, step);
+		renderLevel(dwellBuffer, cmin, dc, step, step == progressiveSteps[0]);
+		DwellBuffer const level = levelSamples(dwellBuffer, step);
+		std::vector<unsigned char> frameBuffer(level.size() * 4);
+		colourBuffer(level, histogram, frameBuffer);
+		if (stream) {
+			writePpm(std::cout, frameBuffer, level.width(), level.height());
+		} else if (!output.empty()) {
+			unsigned int const error = png::encode(pathWithSuffix(output, "-" + std::to_string(step) + ".png"), frameBuffer, level.width(), level.height(), pngLevel);
+			if (error) {
+				return error;
+			}
+		}
+		std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+		latencies.push_back(elapsed.count());
+	}
+	TraceSpan span("level", 0, 0, 1);
+	renderLevel(dwellBuffer, cmin, dc, 1, false);
+	return 0;
+}
+
+/**
+* Colours the cost heat map of the last render: evaluated pixels on a logarithmic ramp of their
+* iterations from black over purple and orange to yellow, pixels that were filled dark blue.
+* The outlines of the filled and computed blocks are drawn on top in the colours of -m.
+*/
+void heatmapFrame(std::vector<unsigned char> &frameBuffer) {
+	static std::vector<std::pair<double,rgb>> const heatGradient = {
+		{ 0.0		, { 0  , 0  , 0   } },
+		{ 0.25		, { 87 , 16 , 110 } },
+		{ 0.5		, { 188, 55 , 84  } },
+		{ 0.75		, { 249, 142, 9   } },
+		{ 1.0		, { 252, 255, 164 } }
+	};
+	static constexpr const unsigned int heatSteps = 256;
+	static rgba const filledColour(0, 0, 48, 255);
+
+	std::vector<rgba> heatColours;
+	for (unsigned int i = 0; i < heatSteps; i++) {
+		double const pos = (double) i / (heatSteps - 1);
+		size_t g = 1;
+		while (heatGradient[g].first < pos) {
+			g++;
+		}
+		rgb const &from = heatGradient[g - 1].second;
+		rgb const &to = heatGradient[g].second;
+		double const blend = (pos - heatGradient[g - 1].first) / (heatGradient[g].first - heatGradient[g - 1].first);
+		heatColours.push_back(rgba(from.r + blend * ((int) to.r - from.r),
+								   from.g + blend * ((int) to.g - from.g),
+								   from.b + blend * ((int) to.b - from.b),
+								   255));
+	}
+
+	unsigned int maxCost = 1;
+	for (unsigned int const cost : heatCost) {
+		if (cost != heatCostFilled) {
+			maxCost = std::max(maxCost, cost);
+		}
+	}
+	double const scale = (heatSteps - 1) / std::log1p((double) maxCost);
+	rgba *pixels = reinterpret_cast<rgba *>(frameBuffer.data());
+	parallelRows(imageHeight, [&](unsigned int const begin, unsigned int const end) {
+		for (size_t i = (size_t) begin * imageWidth; i < (size_t) end * imageWidth; i++) {
+			rgba const &colour = (heatCost[i] == heatCostFilled) ? filledColour
+							   : heatColours[(unsigned int) (std::log1p((double) heatCost[i]) * scale)];
+			pixels[i] = rgba(colour.r, colour.g, colour.b, colour.a);
+		}
+	});
+
+	for (HeatBlock const &block : heatBlocks) {
+		if (block.decision == HeatDecision::Split) {
+			continue;
+		}
+		rgba const &colour = (block.decision == HeatDecision::Fill) ? borderFill : borderCompute;
+		unsigned int const yMax = std::min(block.atY + block.blockSize, imageHeight) - 1;
+		unsigned int const xMax = std::min(block.atX + block.blockSize, imageWidth) - 1;
+		for (unsigned int x = block.atX; x <= xMax; x++) {
+			pixels[(size_t) block.atY * imageWidth + x] = rgba(colour.r, colour.g, colour.b, colour.a);
+			pixels[(size_t) yMax * imageWidth + x] = rgba(colour.r, colour.g, colour.b, colour.a);
+		}
+		for (unsigned int y = block.atY; y <= yMax; y++) {
+			pixels[(size_t) y * imageWidth + block.atX] = rgba(colour.r, colour.g, colour.b, colour.a);
+			pixels[(size_t) y * imageWidth + xMax] = rgba(colour.r, colour.g, colour.b, colour.a);
+		}
+	}
+}
+
+// Writes the blocks of the heat map as CSV, one line per block with its decision and cost
+bool writeHeatBlocks(std::string const &path) {
+	static char const *const decisionNames[] = { "fill", "compute", "split" };
+	std::ofstream file(path);
+	file << "y,x,size,decision,iterations" << std::endl;
+	for (HeatBlock const &block : heatBlocks) {
+		file << block.atY << "," << block.atX << "," << block.blockSize << ","
+			 << decisionNames[(int) block.decision] << "," << block.iterations << std::endl;
+	}
+	file.close();
+	return (bool) file;
+}
+
+// Wall times of the phases of main, with --stats
+struct PhaseTimes {
+	double render;
+	double colour;
+	double antialias;
+	double encode;
+};
+
+/**
+* Prints the phase times and the stats of the last render for an image of pixels pixels,
+* as a summary or as JSON. Per thread stats are only kept for the queue and traditional engines.
+*/
+void printStats(std::ostream &out, PhaseTimes const &phases, size_t const pixels, bool const json) {
+	RenderStats const &total = statsTotal;
+	out << std::fixed << std::setprecision(6);
+	if (json) {
+		out << "{" << std::endl;
+		out << "  \"phases\": { \"render_s\": " << phases.render << ", \"colour_s\": " << phases.colour
+			<< ", \"antialias_s\": " << phases.antialias << ", \"encode_s\": " << phases.encode << " }," << std::endl;
+		out << "  \"work\": { \"border_s\": " << total.borderTime << ", \"subdivision_s\": " << total.subdivisionTime
+			<< ", \"compute_s\": " << total.computeTime << ", \"fill_s\": " << total.fillTime << " }," << std::endl;
+		out << "  \"pixels\": " << pixels << ", \"evaluated\": " << total.evaluated << ", \"border\": " << total.border
+			<< ", \"filled\": " << total.filled << ", \"iterations\": " << total.iterations << "," << std::endl;
+		out << "  \"blocks\": { \"filled\": " << total.decisions[0] << ", \"computed\": " << total.decisions[1]
+			<< ", \"split_2x2\": " << total.decisions[2] << ", \"split_larger\": " << total.decisions[3] << " }," << std::endl;
+		out << "  \"queue\": { \"pushes\": " << total.pushes << ", \"pops\": " << total.pops << " }," << std::endl;
+		out << "  \"threads\": [" << std::endl;
+		for (size_t i = 0; i < statsThreads.size(); i++) {
+			RenderStats const &stats = statsThreads[i];
+			out << "    { \"busy_s\": " << stats.busy << ", \"idle_s\": " << stats.idle << ", \"jobs\": " << stats.pops
+				<< ", \"evaluated\": " << stats.evaluated << ", \"iterations\": " << stats.iterations << " }"
+				<< ((i + 1 < statsThreads.size()) ? "," : "") << std::endl;
+		}
+		out << "  ]" << std::endl << "}" << std::endl;
+		return;
+	}
+	out << std::setprecision(3);
+	out << "Phases:      render " << phases.render << " s, colour " << phases.colour << " s, antialias "
+		<< phases.antialias << " s, encode " << phases.encode << " s" << std::endl;
+	out << "Work:        borders " << total.borderTime << " s, subdivision " << total.subdivisionTime << " s, compute "
+		<< total.computeTime << " s, fill " << total.fillTime << " s (thread time)" << std::endl;
+	out << "Pixels:      " << total.evaluated << " evaluated (" << std::setprecision(1) << 100.0 * total.evaluated / pixels
+		<< "%), " << total.border << " of them on borders, " << total.filled << " filled" << std::endl;
+	out << "Iterations:  " << total.iterations << std::endl;
+	out << "Blocks:      " << total.decisions[0] << " filled, " << total.decisions[1] << " computed, "
+		<< total.decisions[2] + total.decisions[3] << " split" << std::endl;
+	out << "Queue:       " << total.pushes << " pushes, " << total.pops << " pops" << std::endl;
+	out << std::setprecision(3);
+	for (size_t i = 0; i < statsThreads.size(); i++) {
+		RenderStats const &stats = statsThreads[i];
+		out << "Thread " << std::left << std::setw(6) << std::to_string(i) + ":" << std::right
+			<< "busy " << stats.busy << " s, idle " << stats.idle << " s, " << stats.pops << " jobs, "
+			<< stats.evaluated << " pixels" << std::endl;
+	}
+}
+
+/**
+* Complex window of the view at center (x, y) in [0;1] and inverse scale scale for the current
+* image size: cmin is the upper left corner and dc the extent of res pixels. The window spans
+* the shorter side of the image, the longer side extends it around the center.
+*/
+void viewWindow(double const x,
+				double const y,
+				double const scale,
+				std::complex<double> &cmin,
+				std::complex<double> &dc)
+{
+	double const xmin = -3.5 + (2 * 2 * x);
+	double const xmax = -1.5 + (2 * 2 * x);
+	double const ymin = -3.0 + (2 * 2 * y);
+	double const ymax = -1.0 + (2 * 2 * y);
+	double const xlen = std::abs(xmin - xmax);
+	double const ylen = std::abs(ymin - ymax);
+
+	res = std::min(imageWidth, imageHeight);
+	std::complex<double> const squareMin(xmin + (0.5 * (1 - scale) * xlen),ymin + (0.5 * (1 - scale) * ylen));
+	std::complex<double> const squareMax(xmax - (0.5 * (1 - scale) * xlen),ymax - (0.5 * (1 - scale) * ylen));
+	dc = squareMax - squareMin;
+	cmin = std::complex<double>(squareMin.real() - 0.5 * (imageWidth - res) * dc.real() / res,
+								squareMin.imag() - 0.5 * (imageHeight - res) * dc.imag() / res);
+}
+
+// Pixels per side of a tile of the --tiles pyramid
+static constexpr const unsigned int tileSize = 256;
+// Tiles per side of the largest region of a level rendered at once, bounds the memory per level
+static constexpr const unsigned int tileChunk = 8;
+// Levels of the pyramid at most, so the pixel coordinates of the deepest one fit into an unsigned int
+static constexpr const unsigned int tileMaxLevels = 20;
+
+// Creates a directory, an existing one is fine
+bool makeDirectory(std::string const &path) {
+	return ::mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+// Settings and results of a --tiles run, shared by the tile threads
+struct Pyramid {
+	std::string directory;
+	unsigned int levels;
+	unsigned int threads;
+	bool withFraction;
+	png::Level pngLevel;
+	std::complex<double> cmin;
+	std::complex<double> dc;
+	std::atomic<unsigned long long> written;
+	std::atomic<unsigned long long> reused;
+	std::atomic<unsigned int> error;
+};
+
+/**
+* Renders the square region of size pixels at atY, atX of the given level of the pyramid, with
+* the tiles spread over the threads, writes its tiles as directory/level/x/y.png and then
+* recurses into the four times larger region of the next level, split into chunks of at most
+* tileChunk x tileChunk tiles.
+* The pixels of a level on even coordinates sample the same points as the pixels of the level
+* above, so with the parent region at parentY, parentX they are copied instead of computed. A
+* tile whose parent pixels all have the same dwell is taken to lie completely in- or outside of
+* the set like a Mariani-Silver block and upsampled from the parent without computing anything.
+* With fractions only interior tiles are, upsampled smooth shading of the exterior is blocky.
+*/
+void renderChunk(Pyramid &pyramid,
+				 unsigned int const level,
+				 unsigned int const atY,
+				 unsigned int const atX,
+				 unsigned int const size,
+				 DwellBuffer const *parent,
+				 unsigned int const parentY,
+				 unsigned int const parentX)
+{
+	res = tileSize << level;
+	originY = atY;
+	originX = atX;
+	imageWidth = imageHeight = size;
+	DwellBuffer chunk(size, size, -1, pyramid.withFraction, false);
+	unsigned int const tiles = size / tileSize;
+	std::string const levelDirectory = pyramid.directory + "/" + std::to_string(level);
+	makeDirectory(levelDirectory);
+	for (unsigned int column = 0; column < tiles; column++) {
+		makeDirectory(levelDirectory + "/" + std::to_string(atX / tileSize + column));
+	}
+
+	std::atomic<unsigned int> next(0);
+	auto tileWorker = [&]() {
+		std::vector<unsigned char> frameBuffer(tileSize * tileSize * 4);
+		for (unsigned int tile = next++; tile < tiles * tiles; tile = next++) {
+			unsigned int const y0 = tile / tiles * tileSize;
+			unsigned int const x0 = tile % tiles * tileSize;
+			bool uniform = false;
+			if (parent) {
+				unsigned int const py0 = (atY + y0) / 2 - parentY;
+				unsigned int const px0 = (atX + x0) / 2 - parentX;
+				int const first = parent->at(py0, px0);
+				uniform = !chunk.hasFraction() || isInterior(first);
+				for (unsigned int y = 0; y < tileSize / 2 && uniform; y++) {
+					int const *row = parent->row(py0 + y) + px0;
+					uniform = std::all_of(row, row + tileSize / 2, [first](int const dwell) { return dwell == first; });
+				}
+				// Uniform tiles are upsampled completely, the others get the samples they share with the parent
+				unsigned int const stride = (uniform) ? 1 : 2;
+				for (unsigned int y = 0; y < tileSize; y += stride) {
+					for (unsigned int x = 0; x < tileSize; x += stride) {
+						chunk.at(y0 + y, x0 + x) = parent->at(py0 + y / 2, px0 + x / 2);
+						if (chunk.hasFraction()) {
+							chunk.fraction(y0 + y, x0 + x) = parent->fractionData()[(size_t) (py0 + y / 2) * parent->width() + px0 + x / 2];
+						}
+					}
+				}
+			}
+			if (!uniform) {
+				PixelBatch batch(chunk, pyramid.cmin, pyramid.dc);
+				for (unsigned int y = y0; y < y0 + tileSize; y++) {
+					for (unsigned int x = x0; x < x0 + tileSize; x++) {
+						if (chunk.at(y, x) < 0) {
+							batch.add(y, x);
+						}
+					}
+				}
+			} else {
+				pyramid.reused++;
+			}
+
+			DwellBuffer tileBuffer(tileSize, tileSize, -1, pyramid.withFraction, false);
+			extractDwell(chunk, y0, x0, tileBuffer);
+			colourBuffer(tileBuffer, false, frameBuffer, true);
+			std::string const path = levelDirectory + "/" + std::to_string((atX + x0) / tileSize) + "/" + std::to_string((atY + y0) / tileSize) + ".png";
+			unsigned int const error = png::encode(path, frameBuffer, tileSize, tileSize, pyramid.pngLevel);
+			if (error) {
+				pyramid.error = error;
+			}
+			pyramid.written++;
+		}
+		publishStats(-1);
+	};
+	vector<thread> threads;
+	for (unsigned int i = 0; i < std::min(pyramid.threads, tiles * tiles); i++) {
+		threads.push_back(thread(tileWorker));
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+
+	if (level + 1 >= pyramid.levels || pyramid.error) {
+		return;
+	}
+	unsigned int const childSize = std::min(2 * size, tileChunk * tileSize);
+	for (unsigned int y = 0; y < 2 * size; y += childSize) {
+		for (unsigned int x = 0; x < 2 * size; x += childSize) {
+			renderChunk(pyramid, level + 1, 2 * atY + y, 2 * atX + x, childSize, &chunk, atY, atX);
+		}
+	}
+}
+
+/**
+* XYZ tile pyramid of the view: level z consists of 2^z x 2^z tiles of tileSize pixels as
+* directory/z/x/y.png, level 0 is the whole square view of -x, -y and -s. The levels are
+* rendered depth first, so every region of a level has the one of the level above at hand.
+* Returns the first error of writing a tile.
+*/
+unsigned int renderPyramid(std::string const &directory,
+						   unsigned int const levels,
+						   double const x,
+						   double const y,
+						   double const scale,
+						   bool const withFraction,
+						   unsigned int const threads,
+						   png::Level const pngLevel,
+						   unsigned long long &written,
+						   unsigned long long &reused)
+{
+	Pyramid pyramid;
+	pyramid.directory = directory;
+	pyramid.levels = levels;
+	pyramid.threads = (threads) ? threads : std::max(1u, thread::hardware_concurrency());
+	pyramid.withFraction = withFraction;
+	pyramid.pngLevel = pngLevel;
+	pyramid.written = 0;
+	pyramid.reused = 0;
+	pyramid.error = 0;
+	imageWidth = imageHeight = tileSize;
+	viewWindow(x, y, scale, pyramid.cmin, pyramid.dc);
+	statsTotal = RenderStats();
+	if (!makeDirectory(directory)) {
+		return 79;
+	}
+	renderChunk(pyramid, 0, 0, 0, tileSize, nullptr, 0, 0);
+	originY = originX = 0;
+	written = pyramid.written;
+	reused = pyramid.reused;
+	return pyramid.error;
+}
+
+// Viewports of the benchmark, in the units of -x, -y, -s and -i
+struct BenchView {
+	char const *name;
+	double x;
+	double y;
+	double scale;
+	unsigned int maxDwell;
+};
+
+static BenchView const benchViews[] = {
+	{ "full", 0.5, 0.5, 1.0, 512 },
+	{ "seahorse", 0.4375, 0.525, 0.02, 2048 },
+	{ "minibrot", 0.1286184, 0.5, 3e-6, 4096 }
+};
+static unsigned int const benchResolutions[] = { 512, 1024 };
+static unsigned int const benchBlockDims[] = { 4, 16 };
+static unsigned int const benchSubDivs[] = { 2, 4 };
+// Untimed runs before the trials, to fault in the buffer and warm up caches and clocks
+static unsigned int const benchWarmup = 1;
+
+struct BenchResult {
+	Engine engine;
+	unsigned int threads;
+	unsigned int resolution;
+	unsigned int blockDim;
+	unsigned int subDiv;
+	BenchView const *view;
+	double median;
+	double p95;
+	unsigned long long pixels;
+	unsigned long long iterations;
+};
+
+/**
+* Renders the current view benchWarmup + trials times with the given engine and returns the
+* median and 95th percentile (nearest rank) of the timed trials. The engine parameters are
+* taken from the globals like for a normal render.
+*/
+BenchResult benchRun(std::complex<double> const &cmin,
+					 std::complex<double> const &dc,
+					 Engine const engine,
+					 unsigned int const threads,
+					 unsigned int const trials)
+{
+	DwellBuffer dwellBuffer(imageWidth, imageHeight, -1);
+	std::vector<double> times;
+	for (unsigned int run = 0; run < benchWarmup + trials; run++) {
+		dwellBuffer.fill(-1);
+		auto const start = std::chrono::steady_clock::now();
+		render(dwellBuffer, cmin, dc, engine, threads);
+		std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+		if (run >= benchWarmup) {
+			times.push_back(elapsed.count());
+		}
+	}
+	std::sort(times.begin(), times.end());
+	size_t const n = times.size();
+	BenchResult result;
+	result.engine = engine;
+	result.threads = threads;
+	result.median = (n % 2) ? times[n / 2] : 0.5 * (times[n / 2 - 1] + times[n / 2]);
+	result.p95 = times[(size_t) std::ceil(0.95 * n) - 1];
+	result.pixels = dwellBuffer.size();
+	result.iterations = statsTotal.iterations;
+	return result;
+}
+
+/**
+* Benchmark suite: sweeps the engines, thread counts, resolutions, block dimensions and
+* subdivisions over the benchmark viewports and writes one record per configuration to path,
+* as JSON if it ends with .json and as CSV otherwise. Threads 0 is the recursive engine, which
+* spawns a thread per block; block dim and subdivision are 0 for the traditional engine.
+*/
+int bench(std::string const &path, unsigned int const trials, bool const quiet) {
+	unsigned int const hardwareThreads = std::max(1u, thread::hardware_concurrency());
+	std::vector<unsigned int> threadCounts;
+	for (unsigned int threads = 1; threads < hardwareThreads; threads *= 2) {
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(hardwareThreads);
+
+	std::vector<BenchResult> results;
+	auto run = [&](BenchView const &view, std::complex<double> const &cmin, std::complex<double> const &dc, Engine const engine, unsigned int const threads) {
+		BenchResult result = benchRun(cmin, dc, engine, threads, trials);
+		result.resolution = res;
+		result.blockDim = (engine == Engine::Traditional) ? 0 : blockDim;
+		result.subDiv = (engine == Engine::Traditional) ? 0 : subDiv;
+		result.view = &view;
+		if (!quiet) {
+			std::cout << std::fixed << std::setprecision(4) << std::left
+					  << std::setw(12) << engineName(engine) << std::setw(10) << view.name
+					  << std::right << std::setw(5) << res << " px  " << std::setw(2) << threads << " threads  "
+					  << "b " << std::setw(2) << result.blockDim << "  d " << result.subDiv << "  "
+					  << "median " << result.median << " s  p95 " << result.p95 << " s" << std::endl;
+		}
+		results.push_back(result);
+	};
+	for (BenchView const &view : benchViews) {
+		maxDwell = view.maxDwell;
+		for (unsigned int const resolution : benchResolutions) {
+			imageWidth = imageHeight = resolution;
+			std::complex<double> cmin, dc;
+			viewWindow(view.x, view.y, view.scale, cmin, dc);
+			for (unsigned int const dim : benchBlockDims) {
+				for (unsigned int const div : benchSubDivs) {
+					blockDim = dim;
+					subDiv = div;
+					run(view, cmin, dc, Engine::Serial, 1);
+					run(view, cmin, dc, Engine::Recursive, 0);
+					for (unsigned int const threads : threadCounts) {
+						run(view, cmin, dc, Engine::Queue, threads);
+					}
+				}
+			}
+			for (unsigned int const threads : threadCounts) {
+				run(view, cmin, dc, Engine::Traditional, threads);
 			}
 		}
 	}
-}
 
-void help() {
-	std::cout << "Mandelbrot Set Renderer" << std::endl;
-	std::cout << std::endl;
-	std::cout << "\t" << "-x [0;1]" << "\t" << "Center of Re[-1.5;0.5] (default=0.5)" << std::endl;
-	std::cout << "\t" << "-y [0;1]" << "\t" << "Center of Im[-1;1] (default=0.5)" << std::endl;
-	std::cout << "\t" << "-s (0;1]" << "\t" << "Inverse scaling factor (default=1)" << std::endl;
-	std::cout << "\t" << "-r [pixel]" << "\t" << "Image resolution (default=1024)" << std::endl;
-	std::cout << "\t" << "-i [iterations]" << "\t" << "Iterations or max dwell (default=512)" << std::endl;
-	std::cout << "\t" << "-c [colours]" << "\t" << "colour map iterations (default=1)" << std::endl;
-	std::cout << "\t" << "-b [block dim]" << "\t" << "min block dimension for subdivision (default=16)" << std::endl;
-	std::cout << "\t" << "-d [subdivison]" << "\t" << "subdivision of blocks (default=4)" << std::endl;
-	std::cout << "\t" << "-m" << "\t" << "mark Mariani-Silver borders" << std::endl;
-	std::cout << "\t" << "-t" << "\t" << "traditional computation (no Mariani-Silver)" << std::endl;
+	std::ofstream file(path);
+	bool const json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+	file << std::setprecision(9);
+	if (json) {
+		file << "{" << std::endl;
+		file << "  \"warmup\": " << benchWarmup << "," << std::endl;
+		file << "  \"trials\": " << trials << "," << std::endl;
+		file << "  \"hardware_threads\": " << hardwareThreads << "," << std::endl;
+		file << "  \"results\": [" << std::endl;
+	} else {
+		file << "engine,threads,resolution,block_dim,sub_div,viewport,max_dwell,median_s,p95_s,pixels_per_s,iterations_per_s" << std::endl;
+	}
+	for (size_t i = 0; i < results.size(); i++) {
+		BenchResult const &result = results[i];
+		double const pixelRate = result.pixels / result.median;
+		double const iterationRate = result.iterations / result.median;
+		if (json) {
+			file << "    { \"engine\": \"" << engineName(result.engine) << "\", \"threads\": " << result.threads
+				 << ", \"resolution\": " << result.resolution << ", \"block_dim\": " << result.blockDim
+				 << ", \"sub_div\": " << result.subDiv << ", \"viewport\": \"" << result.view->name
+				 << "\", \"max_dwell\": " << result.view->maxDwell << ", \"median_s\": " << result.median
+				 << ", \"p95_s\": " << result.p95 << ", \"pixels_per_s\": " << pixelRate
+				 << ", \"iterations_per_s\": " << iterationRate << " }" << ((i + 1 < results.size()) ? "," : "") << std::endl;
+		} else {
+			file << engineName(result.engine) << "," << result.threads << "," << result.resolution << ","
+				 << result.blockDim << "," << result.subDiv << "," << result.view->name << ","
+				 << result.view->maxDwell << "," << result.median << "," << result.p95 << ","
+				 << pixelRate << "," << iterationRate << std::endl;
+		}
+	}
+	if (json) {
+		file << "  ]" << std::endl << "}" << std::endl;
+	}
+	file.close();
+	if (!file) {
+		std::cout << "An error occurred while writing the benchmark file: " << path << std::endl;
+		return 1;
+	}
+	return 0;
 }
 
-// Multiple thread version for task 2c
-void worker(std::vector<std::vector<int>> &dwellBuffer) {
+// Image sizes of the verification, a square one and a clipped non-square one
+static unsigned int const verifySizes[][2] = { { 256, 256 }, { 320, 200 } };
+
+// Kernel variants of the verification: the dwell alone, with fractions, with distances, with interior detection
+struct VerifyKernel {
+	char const *name;
+	bool fraction;
+	bool distance;
+	bool interior;
+};
+
+static VerifyKernel const verifyKernels[] = {
+	{ "plain", false, false, false },
+	{ "smooth", true, false, false },
+	{ "distance", false, true, false },
+	{ "interior", false, false, true }
+};
+
+// Subdivisions of the verification, the adaptive one only exists in the queue engine
+struct VerifySplit {
+	char const *name;
+	unsigned int blockDim;
+	unsigned int subDiv;
+	bool adaptive;
+};
+
+static VerifySplit const verifySplits[] = {
+	{ "b16 d4", 16, 4, false },
+	{ "b4 d2", 4, 2, false },
+	{ "adaptive", 8, 2, true }
+};
+
+// Share of the pixels a Mariani-Silver render may differ in from the escape time render
+static constexpr const double verifyTolerance = 1e-3;
+
+/**
+* What differingPixels compares: only whether a pixel is inside of the set, the dwell values,
+* or the dwell values and the fractions and distances bitwise
+*/
+enum class VerifyCompare { Membership, Dwell, Exact };
+
+// Pixels in which two renders of the same size differ
+size_t differingPixels(DwellBuffer const &a, DwellBuffer const &b, VerifyCompare const compare) {
+	bool const planes = compare == VerifyCompare::Exact;
+	size_t differing = 0;
+	for (unsigned int y = 0; y < a.height(); y++) {
+		for (unsigned int x = 0; x < a.width(); x++) {
+			size_t const i = (size_t) y * a.width() + x;
+			bool differs = (compare == VerifyCompare::Membership) ? isInterior(a.at(y, x)) != isInterior(b.at(y, x))
+																  : a.at(y, x) != b.at(y, x);
+			if (planes && a.hasFraction()) {
+				differs = differs || std::memcmp(a.fractionData() + i, b.fractionData() + i, sizeof(float)) != 0;
+			}
+			if (planes && a.hasDistance()) {
+				differs = differs || std::memcmp(a.distanceRow(y) + x, b.distanceRow(y) + x, sizeof(float)) != 0;
+			}
+			differing += differs;
+		}
+	}
+	return differing;
+}
 
-	// Initialize an empty job
-	job currentTask{
-		dwellBuffer,0,0,0,0,NULL,NULL
+/**
+* Correctness sweep: renders the benchmark viewports in every size and kernel variant with the
+* escape time algorithm on one thread as reference and compares all engines, thread counts and
+* subdivisions against it. The traditional engine and the progressive render, in dwell and in
+* histogram equalized colours, have to match the reference exactly. The Mariani-Silver engines
+* approximate it, so the first render of every subdivision is allowed to differ in up to
+* verifyTolerance of the pixels (in set membership for the distance estimation), and every other
+* engine and thread count has to reproduce that render exactly. Returns 1 if any check failed.
+*/
+int verify(bool const quiet) {
+	unsigned int const hardwareThreads = std::max(1u, thread::hardware_concurrency());
+	// More threads than cores as well, so the queue sees contention on small machines too
+	unsigned int const threadCounts[] = { 1, 3, std::max(4u, hardwareThreads) };
+	mark = false;
+	heatmap = false;
+
+	unsigned int checks = 0;
+	unsigned int failed = 0;
+	auto report = [&](BenchView const &view, VerifyKernel const &kernel, char const *what, Engine const engine,
+					  unsigned int const threads, size_t const differing, size_t const allowed) {
+		bool const pass = differing <= allowed;
+		checks++;
+		failed += !pass;
+		if (!quiet || !pass) {
+			std::cout << std::left << ((pass) ? "PASS  " : "FAIL  ")
+					  << std::setw(10) << view.name << std::setw(10) << kernel.name
+					  << std::right << std::setw(4) << imageWidth << "x" << std::left << std::setw(5) << imageHeight
+					  << std::setw(10) << what << std::setw(12) << engineName(engine)
+					  << std::right << std::setw(2) << threads << " threads  "
+					  << differing << " differing pixels" << std::endl;
+		}
 	};
 
-	// Continue until there is work to do
-	while(counter < limit) {
-		// Scope of mutexVariable2
-		{
-			// Acquire the lock on mutexVariable2
-			unique_lock<mutex> lck(mutexVariable2);
-			// If the queue is empty wait until a new job it's available
-			while(queue.empty() && counter < limit) {
-				myCv.wait(lck);
+	for (BenchView const &view : benchViews) {
+		maxDwell = view.maxDwell;
+		for (auto const &size : verifySizes) {
+			imageWidth = size[0];
+			imageHeight = size[1];
+			res = std::min(imageWidth, imageHeight);
+			std::complex<double> cmin, dc;
+			viewWindow(view.x, view.y, view.scale, cmin, dc);
+			for (VerifyKernel const &kernel : verifyKernels) {
+				interiorDetection = kernel.interior;
+				auto renderWith = [&](Engine const engine, unsigned int const threads) {
+					DwellBuffer dwellBuffer(imageWidth, imageHeight, -1, kernel.fraction, kernel.distance);
+					render(dwellBuffer, cmin, dc, engine, threads);
+					return dwellBuffer;
+				};
+
+				// Exterior blocks of the distance estimation are filled with their smallest border dwell,
+				// so only their membership to the set is comparable to the reference
+				VerifyCompare const approximate = (kernel.distance) ? VerifyCompare::Membership : VerifyCompare::Dwell;
+				adaptive = false;
+				DwellBuffer const reference = renderWith(Engine::Traditional, 1);
+				for (unsigned int const threads : threadCounts) {
+					if (threads > 1) {
+						report(view, kernel, "escape", Engine::Traditional, threads, differingPixels(reference, renderWith(Engine::Traditional, threads), VerifyCompare::Exact), 0);
+					}
+				}
+
+				// The progressive render computes the same pixels and, with the colour map rebuilt after
+				// the levels as main does, colours them the same. Histogram equalization spreads over
+				// the whole map, so it shows a map that wasn't rebuilt from scratch.
+				auto colourWith = [&](DwellBuffer const &dwellBuffer) {
+					std::vector<unsigned char> frameBuffer(dwellBuffer.size() * 4);
+					createColourMap(maxDwell);
+					createColourTables(maxDwell);
+					colourBuffer(dwellBuffer, true, frameBuffer);
+					return frameBuffer;
+				};
+				std::vector<unsigned char> const expected = colourWith(reference);
+				DwellBuffer progressiveBuffer(imageWidth, imageHeight, -1, kernel.fraction, kernel.distance);
+				std::vector<double> latencies;
+				renderProgressive(progressiveBuffer, cmin, dc, true, std::string(), false, png::Level::Store, latencies);
+				std::vector<unsigned char> const frame = colourWith(progressiveBuffer);
+				size_t differingColours = 0;
+				for (size_t i = 0; i < progressiveBuffer.size(); i++) {
+					differingColours += std::memcmp(&frame[4 * i], &expected[4 * i], 4) != 0;
+				}
+				report(view, kernel, "levels", Engine::Traditional, hardwareThreads, differingPixels(reference, progressiveBuffer, VerifyCompare::Exact), 0);
+				report(view, kernel, "level rgb", Engine::Traditional, hardwareThreads, differingColours, 0);
+
+				for (VerifySplit const &split : verifySplits) {
+					blockDim = split.blockDim;
+					subDiv = split.subDiv;
+					adaptive = split.adaptive;
+					std::vector<std::pair<Engine, unsigned int>> runs;
+					if (!split.adaptive) {
+						runs.emplace_back(Engine::Serial, 1);
+						runs.emplace_back(Engine::Recursive, 0);
+					}
+					for (unsigned int const threads : threadCounts) {
+						runs.emplace_back(Engine::Queue, threads);
+					}
+
+					DwellBuffer const approximation = renderWith(runs.front().first, runs.front().second);
+					report(view, kernel, split.name, runs.front().first, runs.front().second,
+						   differingPixels(reference, approximation, approximate), (size_t) (verifyTolerance * reference.size()));
+					for (size_t i = 1; i < runs.size(); i++) {
+						report(view, kernel, split.name, runs[i].first, runs[i].second,
+							   differingPixels(approximation, renderWith(runs[i].first, runs[i].second), VerifyCompare::Exact), 0);
+					}
+				}
 			}
-			// If there is work to do just pop it from the queue
-			if(counter < limit){
-				currentTask.dwellBuffer = queue.front().dwellBuffer;
-				currentTask.cmin = queue.front().cmin;
-				currentTask.dc = queue.front().dc;
-				currentTask.atX = queue.front().atX;
-				currentTask.atY = queue.front().atY;
-				currentTask.blockSize = queue.front().blockSize;
-				queue.pop_front();
-				counter++;
+		}
+	}
+	std::cout << "Verified:    " << checks << " checks, " << failed << " failed" << std::endl;
+	return (failed) ? 1 : 0;
+}
+
+#ifdef USE_MPI
+// Tiles per process a distributed render aims for, enough for the scheduler to even out their cost
+static unsigned int const mpiTilesPerRank = 16;
+// Tiles every worker holds, so the next one is there while it sends the last one back
+static unsigned int const mpiPrefetch = 2;
+// Samples per side of a tile in the cost estimation
+static unsigned int const mpiCostSamples = 8;
+// Seconds rank 0 waits between polls for finished tiles, so it leaves its cores to the local render
+static constexpr const double mpiPollInterval = 1e-3;
+// Tag of every message. The tile index travels in the payload, MPI only guarantees tags up to 32767
+static constexpr const int mpiTag = 0;
+
+/**
+* MPI for the lifetime of main, finalized on every return path. Only the main thread calls
+* MPI, the render threads never do.
+*/
+struct MpiSession {
+	int rank;
+	int size;
+
+	MpiSession(int &argc, char **&argv) {
+		int provided;
+		MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+		MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+		MPI_Comm_size(MPI_COMM_WORLD, &size);
+	}
+	~MpiSession() { MPI_Finalize(); }
+};
+
+// Square tiles of a distributed render, the ones at the right and bottom edge are clipped
+struct TileGrid {
+	unsigned int size;
+	unsigned int columns;
+	unsigned int rows;
+	unsigned int imageWidth;
+	unsigned int imageHeight;
+
+	unsigned int count() const { return columns * rows; }
+	unsigned int atY(unsigned int const tile) const { return tile / columns * size; }
+	unsigned int atX(unsigned int const tile) const { return tile % columns * size; }
+	unsigned int width(unsigned int const tile) const { return std::min(size, imageWidth - atX(tile)); }
+	unsigned int height(unsigned int const tile) const { return std::min(size, imageHeight - atY(tile)); }
+};
+
+/**
+* Tiles for ranks processes: root blocks of the engine, subdivided until there are
+* mpiTilesPerRank tiles per process or they reach the min block dimension.
+*/
+TileGrid tileGrid(Engine const engine, unsigned int const ranks) {
+	unsigned int const division = rootDivision(engine);
+	TileGrid grid;
+	grid.size = rootBlockSize(engine);
+	grid.imageWidth = imageWidth;
+	grid.imageHeight = imageHeight;
+	while (true) {
+		grid.columns = (imageWidth + grid.size - 1) / grid.size;
+		grid.rows = (imageHeight + grid.size - 1) / grid.size;
+		if (grid.count() >= mpiTilesPerRank * ranks || grid.size / division < blockDim) {
+			return grid;
+		}
+		grid.size /= division;
+	}
+}
+
+/**
+* Cost pre-pass: estimates the iterations of every tile from the dwell of mpiCostSamples x
+* mpiCostSamples pixels spread over it and returns the tiles from the most to the least
+* expensive. Handing out the expensive tiles first leaves the cheap ones to fill the gaps
+* at the end of the render. The Mariani-Silver engines fill the interior for the cost of
+* its border, so there an interior sample only counts the border share of the tile.
+*/
+std::vector<unsigned int> tilesByCost(TileGrid const &grid,
+									  std::complex<double> const &cmin,
+									  std::complex<double> const &dc,
+									  Engine const engine)
+{
+	unsigned long long const interiorCost = (engine == Engine::Traditional) ? maxDwell
+																			: std::max(4ull * maxDwell / grid.size, 1ull);
+	std::vector<unsigned long long> cost(grid.count());
+	parallelRows(grid.count(), [&](unsigned int const begin, unsigned int const end) {
+		for (unsigned int tile = begin; tile < end; tile++) {
+			unsigned long long sum = 0;
+			for (unsigned int i = 0; i < mpiCostSamples; i++) {
+				for (unsigned int j = 0; j < mpiCostSamples; j++) {
+					double const y = grid.atY(tile) + (i + 0.5) * grid.height(tile) / mpiCostSamples;
+					double const x = grid.atX(tile) + (j + 0.5) * grid.width(tile) / mpiCostSamples;
+					unsigned int const dwell = interiorDetection ? pixelDwell<false, true>(cmin, dc, y, x, nullptr)
+																 : pixelDwell<false, false>(cmin, dc, y, x, nullptr);
+					sum += (dwell >= maxDwell) ? interiorCost : dwell;
+				}
 			}
-		// Unlock mutexVariable2
+			cost[tile] = sum;
 		}
-		// Execute the actual work
-		marianiSilverJob(currentTask.dwellBuffer, currentTask.cmin, currentTask.dc, currentTask.atY, currentTask.atX, currentTask.blockSize);
+	});
+	std::vector<unsigned int> order(grid.count());
+	for (unsigned int tile = 0; tile < grid.count(); tile++) {
+		order[tile] = tile;
 	}
+	std::stable_sort(order.begin(), order.end(), [&](unsigned int const a, unsigned int const b) {
+		return cost[a] > cost[b];
+	});
+	return order;
 }
 
-// Single thread worker function for task 2a
-void workerWithoutThread(void){
-	while(!queue.empty()){
-		job currentTask = queue.front();
-		queue.pop_front();
-		marianiSilverJob(currentTask.dwellBuffer, currentTask.cmin, currentTask.dc, currentTask.atY, currentTask.atX, currentTask.blockSize);
+/**
+* Renders a tile of the grid into its own buffer as a single root block: for the duration of
+* the render the image is the tile, offset by its upper left pixel, so every pixel samples the
+* same point as in a render of the whole image.
+*/
+DwellBuffer renderTile(TileGrid const &grid,
+					   unsigned int const tile,
+					   bool const withFraction,
+					   bool const withDistance,
+					   std::complex<double> const &cmin,
+					   std::complex<double> const &dc,
+					   Engine const engine,
+					   unsigned int const threads)
+{
+	originY = grid.atY(tile);
+	originX = grid.atX(tile);
+	imageWidth = grid.width(tile);
+	imageHeight = grid.height(tile);
+	rootLimit = grid.size;
+	DwellBuffer buffer(imageWidth, imageHeight, -1, withFraction, withDistance);
+	render(buffer, cmin, dc, engine, threads);
+	imageWidth = grid.imageWidth;
+	imageHeight = grid.imageHeight;
+	originY = originX = 0;
+	rootLimit = 0;
+	return buffer;
+}
+
+// Work of one process in a distributed render, for the efficiency report
+struct RankLoad {
+	double render;
+	unsigned long long tiles;
+	unsigned long long iterations;
+};
+
+/**
+* Distributed render over all processes with rank 0 as scheduler. Rank 0 orders the tiles by
+* their estimated cost and hands them out mpiPrefetch at a time, each finished tile a worker
+* sends back is answered with the next one until there are none left. The workers send their
+* tiles packed with packDwell with non-blocking sends and render on while they are in flight.
+* Rank 0 renders tiles from the same queue on a thread of its own, while its main thread
+* answers the workers and unpacks their tiles into dwellBuffer. dwellBuffer is only used on
+* rank 0, where statsTotal ends up with the counters of all processes and, unless quiet, the
+* parallel efficiency is reported.
+*/
+void renderDistributed(MpiSession const &mpi,
+					   TileGrid const &grid,
+					   DwellBuffer &dwellBuffer,
+					   bool const withFraction,
+					   bool const withDistance,
+					   std::complex<double> const &cmin,
+					   std::complex<double> const &dc,
+					   Engine const engine,
+					   unsigned int const threads,
+					   bool const quiet)
+{
+	auto const start = std::chrono::steady_clock::now();
+	RenderStats local = {};
+	RankLoad load = {};
+	auto renderOwn = [&](unsigned int const tile) {
+		auto const begin = std::chrono::steady_clock::now();
+		DwellBuffer buffer = renderTile(grid, tile, withFraction, withDistance, cmin, dc, engine, threads);
+		std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - begin;
+		local += statsTotal;
+		load.render += elapsed.count();
+		load.tiles++;
+		return buffer;
+	};
+	auto fail = [](char const *what, unsigned int const tile, unsigned int const error) {
+		std::cout << "An error occurred while " << what << " tile " << tile << ": " << error << ": " << lodepng_error_text(error) << std::endl;
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	};
+
+	if (mpi.rank == 0) {
+		std::vector<unsigned int> const order = tilesByCost(grid, cmin, dc, engine);
+		size_t next = 0;
+		std::mutex nextMutex;
+		// Next tile of the queue, or -1 once every tile is handed out
+		auto take = [&]() {
+			std::lock_guard<std::mutex> lock(nextMutex);
+			return (next < order.size()) ? (int) order[next++] : -1;
+		};
+		thread own([&]() {
+			for (int tile = take(); tile >= 0; tile = take()) {
+				copyDwell(renderOwn(tile), dwellBuffer, grid.atY(tile), grid.atX(tile));
+			}
+		});
+
+		std::vector<unsigned int> outstanding(mpi.size, 0);
+		std::vector<bool> stopped(mpi.size, false);
+		unsigned int active = mpi.size - 1;
+		auto hand = [&](int const worker) {
+			int const tile = take();
+			if (tile >= 0) {
+				outstanding[worker]++;
+			} else if (outstanding[worker] > 0 || stopped[worker]) {
+				// The worker still has tiles to send back, it gets told to stop after the last one
+				return;
+			} else {
+				stopped[worker] = true;
+				active--;
+			}
+			MPI_Send(&tile, 1, MPI_INT, worker, mpiTag, MPI_COMM_WORLD);
+		};
+		for (int worker = 1; worker < mpi.size; worker++) {
+			for (unsigned int i = 0; i < mpiPrefetch; i++) {
+				hand(worker);
+			}
+		}
+		std::vector<unsigned char> packed;
+		while (active > 0) {
+			int arrived;
+			MPI_Status status;
+			MPI_Iprobe(MPI_ANY_SOURCE, mpiTag, MPI_COMM_WORLD, &arrived, &status);
+			if (!arrived) {
+				std::this_thread::sleep_for(std::chrono::duration<double>(mpiPollInterval));
+				continue;
+			}
+			int count;
+			MPI_Get_count(&status, MPI_UNSIGNED_CHAR, &count);
+			packed.resize(count);
+			MPI_Recv(packed.data(), count, MPI_UNSIGNED_CHAR, status.MPI_SOURCE, mpiTag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+			// The tile index follows the packed planes
+			unsigned int tile;
+			std::memcpy(&tile, packed.data() + count - sizeof(tile), sizeof(tile));
+			packed.resize(count - sizeof(tile));
+			outstanding[status.MPI_SOURCE]--;
+			hand(status.MPI_SOURCE);
+			unsigned int const error = unpackDwell(packed, dwellBuffer, grid.atY(tile), grid.atX(tile), grid.width(tile), grid.height(tile));
+			if (error) {
+				fail("unpacking", tile, error);
+			}
+		}
+		own.join();
+	} else {
+		// Packed tiles in flight, their buffers have to live until the send completed
+		std::deque<std::pair<std::vector<unsigned char>, MPI_Request>> sending;
+		while (true) {
+			int tile;
+			MPI_Recv(&tile, 1, MPI_INT, 0, mpiTag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+			if (tile < 0) {
+				break;
+			}
+			DwellBuffer const buffer = renderOwn(tile);
+			sending.emplace_back(std::vector<unsigned char>(), MPI_Request());
+			std::vector<unsigned char> &packed = sending.back().first;
+			unsigned int const error = packDwell(buffer, packed);
+			if (error) {
+				fail("packing", tile, error);
+			}
+			unsigned char const *index = reinterpret_cast<unsigned char const *>(&tile);
+			packed.insert(packed.end(), index, index + sizeof(tile));
+			MPI_Isend(packed.data(), (int) packed.size(), MPI_UNSIGNED_CHAR, 0, mpiTag, MPI_COMM_WORLD, &sending.back().second);
+			while (!sending.empty()) {
+				int done;
+				MPI_Test(&sending.front().second, &done, MPI_STATUS_IGNORE);
+				if (!done) {
+					break;
+				}
+				sending.pop_front();
+			}
+		}
+		for (auto &send : sending) {
+			MPI_Wait(&send.second, MPI_STATUS_IGNORE);
+		}
+	}
+	std::chrono::duration<double> const wall = std::chrono::steady_clock::now() - start;
+	load.iterations = local.iterations;
+
+	unsigned long long counters[] = { local.evaluated, local.iterations, local.border, local.filled,
+									  local.decisions[0], local.decisions[1], local.decisions[2], local.decisions[3] };
+	unsigned long long totals[8] = {};
+	MPI_Reduce(counters, totals, 8, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+	statsTotal = local;
+	statsTotal.evaluated = totals[0];
+	statsTotal.iterations = totals[1];
+	statsTotal.border = totals[2];
+	statsTotal.filled = totals[3];
+	std::copy(totals + 4, totals + 8, statsTotal.decisions);
+
+	std::vector<RankLoad> loads(mpi.size);
+	MPI_Gather(&load, (int) sizeof(RankLoad), MPI_BYTE, loads.data(), (int) sizeof(RankLoad), MPI_BYTE, 0, MPI_COMM_WORLD);
+	if (mpi.rank == 0 && !quiet) {
+		// Parallel efficiency: the render time of all processes over the time they were there for.
+		// The imbalance is the slowest process over the mean one.
+		double sum = 0, slowest = 0;
+		for (int rank = 0; rank < mpi.size; rank++) {
+			RankLoad const &rankLoad = loads[rank];
+			sum += rankLoad.render;
+			slowest = std::max(slowest, rankLoad.render);
+			std::cout << "Rank " << std::left << std::setw(7) << rank << std::right << std::setw(5) << rankLoad.tiles << " tiles  "
+					  << std::fixed << std::setprecision(3) << rankLoad.render << " s rendering  "
+					  << rankLoad.iterations << " iterations" << std::endl;
+		}
+		std::cout << "Efficiency:  " << std::setprecision(1) << 100.0 * sum / (mpi.size * wall.count()) << "% of "
+				  << mpi.size << " processes over " << std::setprecision(3) << wall.count() << " s, imbalance "
+				  << std::setprecision(2) << slowest / (sum / mpi.size) << std::endl;
 	}
 }
+#endif
 
 int main( int argc, char *argv[] )
 {
+#ifdef USE_MPI
+	MpiSession mpi(argc, argv);
+#endif
 	std::string output = "output.png";
+	std::string dwellOutput;
+	std::string recolourInput;
+	bool saveDwell = false;
+	bool smooth = false;
+	bool histogram = false;
+	bool distance = false;
+	unsigned int aaGrid = 0;
+	unsigned int aaThreshold = 0;
 	double x = 0.5, y = 0.5;
 	double scale = 1;
 	unsigned int colourIterations = 1;
-	bool mariani = true;
+	Engine engine = Engine::Queue;
+	unsigned int threadCount = 0;
+	std::string benchOutput;
+	unsigned int benchTrials = 5;
+	bool verifyRun = false;
+	std::string statsOutput;
+	std::string traceOutput;
+	std::string heatmapOutput;
+	std::string previewOutput;
+	std::string tilesOutput;
+	unsigned int tileLevels = 4;
+	bool progressive = false;
+	bool progressiveStream = false;
+	std::vector<double> latencies;
+	PhaseTimes phases = {};
 	bool quiet = false;
+	png::Level pngLevel = png::Level::Default;
 
 	{
-		char c;
-		while((c = getopt(argc,argv,"x:y:s:r:o:i:c:b:d:mthq"))!=-1) {
+		// Long options without a short equivalent use values outside the char range
+		enum { optPngLevel = 256, optDwell, optSaveDwell, optRecolour, optSmooth, optHistogram, optDistance, optInterior, optAa, optAaThreshold, optWidth, optHeight, optAdaptive, optEngine, optThreads, optBench, optBenchTrials, optStats, optTrace, optHeatmap, optVerify, optPrepass, optProgressive, optTiles, optTileLevels };
+		static struct option const longOptions[] = {
+			{ "png-level", required_argument, nullptr, optPngLevel },
+			{ "dwell", required_argument, nullptr, optDwell },
+			{ "save-dwell", no_argument, nullptr, optSaveDwell },
+			{ "recolour", required_argument, nullptr, optRecolour },
+			{ "smooth", no_argument, nullptr, optSmooth },
+			{ "histogram", no_argument, nullptr, optHistogram },
+			{ "distance", no_argument, nullptr, optDistance },
+			{ "interior", no_argument, nullptr, optInterior },
+			{ "aa", optional_argument, nullptr, optAa },
+			{ "aa-threshold", required_argument, nullptr, optAaThreshold },
+			{ "width", required_argument, nullptr, optWidth },
+			{ "height", required_argument, nullptr, optHeight },
+			{ "adaptive", no_argument, nullptr, optAdaptive },
+			{ "engine", required_argument, nullptr, optEngine },
+			{ "threads", required_argument, nullptr, optThreads },
+			{ "bench", optional_argument, nullptr, optBench },
+			{ "bench-trials", required_argument, nullptr, optBenchTrials },
+			{ "stats", optional_argument, nullptr, optStats },
+			{ "trace", required_argument, nullptr, optTrace },
+			{ "heatmap", optional_argument, nullptr, optHeatmap },
+			{ "prepass", optional_argument, nullptr, optPrepass },
+			{ "progressive", optional_argument, nullptr, optProgressive },
+			{ "tiles", required_argument, nullptr, optTiles },
+			{ "tile-levels", required_argument, nullptr, optTileLevels },
+			{ "verify", no_argument, nullptr, optVerify },
+			{ nullptr, 0, nullptr, 0 }
+		};
+		int c;
+		while((c = getopt_long(argc,argv,"x:y:s:r:o:i:c:b:d:mthq",longOptions,nullptr))!=-1) {
 			switch(c) {
 				case 'x':
 					x = num::clamp(atof(optarg),0.0,1.0);
@@ -551,7 +3205,7 @@ int main( int argc, char *argv[] )
 					if (scale == 0) scale = 1;
 					break;
 				case 'r':
-					res = std::max(1,atoi(optarg));
+					imageWidth = imageHeight = std::max(1,atoi(optarg));
 					break;
 				case 'i':
 					maxDwell = std::max(1,atoi(optarg));
@@ -569,7 +3223,7 @@ int main( int argc, char *argv[] )
 					mark = true;
 					break;
 				case 't':
-					mariani = false;
+					engine = Engine::Traditional;
 					break;
 				case 'q':
 					quiet = true;
@@ -577,135 +3231,405 @@ int main( int argc, char *argv[] )
 				case 'o':
 					output = optarg;
 					break;
+				case optPngLevel:
+					if (!png::parseLevel(optarg, pngLevel)) {
+						std::cerr << "Unknown PNG level '" << optarg << "'" << std::endl << std::endl;
+						help();
+						exit(1);
+					}
+					break;
+				case optDwell:
+					dwellOutput = optarg;
+					break;
+				case optSaveDwell:
+					saveDwell = true;
+					break;
+				case optRecolour:
+					recolourInput = optarg;
+					break;
+				case optSmooth:
+					smooth = true;
+					break;
+				case optHistogram:
+					histogram = true;
+					break;
+				case optDistance:
+					distance = true;
+					break;
+				case optInterior:
+					interiorDetection = true;
+					break;
+				case optAa:
+					aaGrid = (optarg) ? num::clamp(atoi(optarg), 1, 16) : 3;
+					break;
+				case optAaThreshold:
+					aaThreshold = std::max(0, atoi(optarg));
+					break;
+				case optWidth:
+					imageWidth = std::max(1,atoi(optarg));
+					break;
+				case optHeight:
+					imageHeight = std::max(1,atoi(optarg));
+					break;
+				case optAdaptive:
+					adaptive = true;
+					break;
+				case optEngine:
+					if (!parseEngine(optarg, engine)) {
+						std::cerr << "Unknown engine '" << optarg << "'" << std::endl << std::endl;
+						help();
+						exit(1);
+					}
+					break;
+				case optThreads:
+					threadCount = std::max(0, atoi(optarg));
+					break;
+				case optBench:
+					benchOutput = (optarg) ? optarg : "bench.csv";
+					break;
+				case optBenchTrials:
+					benchTrials = std::max(1, atoi(optarg));
+					break;
+				case optStats:
+					collectStats = true;
+					statsOutput = (optarg) ? optarg : "";
+					break;
+				case optTrace:
+					traceOutput = optarg;
+					break;
+				case optHeatmap:
+					heatmap = true;
+					heatmapOutput = (optarg) ? optarg : "";
+					break;
+				case optVerify:
+					verifyRun = true;
+					break;
+				case optPrepass:
+					prepass = true;
+					previewOutput = (optarg) ? optarg : "";
+					break;
+				case optTiles:
+					tilesOutput = optarg;
+					break;
+				case optTileLevels:
+					tileLevels = std::min(std::max(1, atoi(optarg)), (int) tileMaxLevels);
+					break;
+				case optProgressive:
+					progressive = true;
+					if (optarg && std::string(optarg) != "-") {
+						std::cout << "Unknown progressive output: " << optarg << ", only - for stdout" << std::endl;
+						return 1;
+					}
+					// The frames go to stdout, so nothing else may
+					progressiveStream = optarg != nullptr;
+					quiet = quiet || progressiveStream;
+					break;
 				case 'h':
 					help();
 					exit(0);
 					break;
 				default:
-					std::cerr << "Unknown argument '" << c << "'" << std::endl << std::endl;
+					std::cerr << "Unknown argument '" << (char) c << "'" << std::endl << std::endl;
 					help();
 					exit(1);
 			}
 		}
 	}
 
-	double const xmin = -3.5 + (2 * 2 * x);
-	double const xmax = -1.5 + (2 * 2 * x);
-	double const ymin = -3.0 + (2 * 2 * y);
-	double const ymax = -1.0 + (2 * 2 * y);
-	double const xlen = std::abs(xmin - xmax);
-	double const ylen = std::abs(ymin - ymax);
+	if (saveDwell && dwellOutput.empty()) {
+		dwellOutput = dwellPathFor(output);
+	}
+	if (heatmap && heatmapOutput.empty()) {
+		heatmapOutput = pathWithSuffix(output, "-heatmap.png");
+	}
+	if (heatmap && !recolourInput.empty()) {
+		std::cout << "A heat map needs a render, it can't be combined with --recolour" << std::endl;
+		return 1;
+	}
+	if (progressive && !recolourInput.empty()) {
+		std::cout << "A progressive render can't be combined with --recolour" << std::endl;
+		return 1;
+	}
+	if (progressive && prepass) {
+		std::cout << "A progressive render runs no Mariani-Silver pass, it can't be combined with --prepass" << std::endl;
+		return 1;
+	}
+	if (!previewOutput.empty() && !recolourInput.empty()) {
+		std::cout << "A preview needs a render, it can't be combined with --recolour" << std::endl;
+		return 1;
+	}
+	if (!tilesOutput.empty() && (heatmap || collectStats || !traceOutput.empty() || !dwellOutput.empty() || aaGrid > 0 || progressive
+								 || mark || prepass || !recolourInput.empty())) {
+		std::cout << "Tiles are rendered chunk by chunk, they can't be combined with --heatmap, --stats, --trace, --dwell, --save-dwell, "
+				  << "--aa, --progressive, --prepass, --recolour or -m" << std::endl;
+		return 1;
+	}
+
+#ifdef USE_MPI
+	if (mpi.size > 1) {
+		if (!benchOutput.empty() || verifyRun || !recolourInput.empty() || !tilesOutput.empty()) {
+			// Nothing to distribute, rank 0 runs these alone
+			if (mpi.rank != 0) {
+				return 0;
+			}
+		} else if (heatmap || collectStats || !traceOutput.empty() || !previewOutput.empty() || progressive) {
+			if (mpi.rank == 0) {
+				std::cout << "--heatmap, --stats, --trace, --progressive and the --prepass preview only see a single process, run them without mpirun" << std::endl;
+			}
+			return 1;
+		}
+		quiet = quiet || mpi.rank != 0;
+	}
+#endif
+	if (!benchOutput.empty()) {
+		return bench(benchOutput, benchTrials, quiet);
+	}
+	if (verifyRun) {
+		return verify(quiet);
+	}
+	if (!tilesOutput.empty()) {
+		if (distance || histogram) {
+			std::cout << "Tiles are coloured one by one, --distance and --histogram aren't supported" << std::endl;
+			return 1;
+		}
+		createColourMap(maxDwell / colourIterations);
+		createColourTables(maxDwell);
+		auto const start = std::chrono::steady_clock::now();
+		unsigned long long written, reused;
+		unsigned int const error = renderPyramid(tilesOutput, tileLevels, x, y, scale, smooth, threadCount, pngLevel, written, reused);
+		if (error) {
+			std::cout << "An error occurred while writing the tiles: " << error << ": " << lodepng_error_text(error) << std::endl;
+			return 1;
+		}
+		std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+		if (!quiet) {
+			std::cout << "Tiles:       " << written << " in " << tileLevels << " levels to " << tilesOutput << "/z/x/y.png, "
+					  << reused << " upsampled from uniform parents" << std::endl;
+			std::cout << "Evaluated:   " << statsTotal.evaluated << " pixels in " << std::fixed << std::setprecision(3) << elapsed.count() << " s" << std::endl;
+		}
+		return 0;
+	}
+	if (!traceOutput.empty()) {
+		tracing = true;
+		traceStart = std::chrono::steady_clock::now();
+		traceThread("main");
+	}
 
-	std::complex<double> const cmin(xmin + (0.5 * (1 - scale) * xlen),ymin + (0.5 * (1 - scale) * ylen));
-	std::complex<double> const cmax(xmax - (0.5 * (1 - scale) * xlen),ymax - (0.5 * (1 - scale) * ylen));
-	std::complex<double> const dc = cmax - cmin;
+	std::complex<double> cmin, dc;
+	viewWindow(x, y, scale, cmin, dc);
+	std::complex<double> const cmax(cmin.real() + (double) imageWidth * dc.real() / res,
+									cmin.imag() + (double) imageHeight * dc.imag() / res);
+#ifdef USE_MPI
+	TileGrid const grid = tileGrid(engine, mpi.size);
+	if (mpi.size > 1 && mpi.rank != 0) {
+		// The other processes only render tiles for rank 0
+		DwellBuffer unused;
+		renderDistributed(mpi, grid, unused, smooth && !distance, distance, cmin, dc, engine, threadCount, quiet);
+		return 0;
+	}
+#endif
 
-	if (!quiet) {
+	if (!quiet && recolourInput.empty()) {
 		std::cout << std::fixed;
 		std::cout << "Center:      [" << x << "," << y << "]" << std::endl;
 		std::cout << "Zoom:        " << (unsigned long long) (1/scale) * 100 << "%" <<  std::endl;
 		std::cout << "Iterations:  " << maxDwell  << std::endl;
+		std::cout << "Size:        " << imageWidth << "x" << imageHeight << std::endl;
 		std::cout << "Window:      Re[" << cmin.real() << ", " << cmax.real() << "], Im[" << cmin.imag() << ", " << cmax.imag() << "]" << std::endl;
 		std::cout << "Output:      " << output << std::endl;
+		std::cout << "Engine:      " << engineName(engine) << std::endl;
 		std::cout << "Block dim:   " << blockDim << std::endl;
-		std::cout << "Subdivision: " << subDiv << std::endl;
+#ifdef USE_MPI
+		if (mpi.size > 1) {
+			std::cout << "Processes:   " << mpi.size << ", " << grid.count() << " tiles of " << grid.size << std::endl;
+		}
+#endif
+		if (adaptive) {
+			std::cout << "Subdivision: adaptive" << std::endl;
+		} else {
+			std::cout << "Subdivision: " << subDiv << std::endl;
+		}
 		std::cout << "Borders:     " << ((mark) ? "marking" : "not marking") << std::endl;
+		std::cout << "Interior:    " << ((interiorDetection) ? "detecting" : "iterating") << std::endl;
+		std::cout << "PNG level:   " << png::levelName(pngLevel) << std::endl;
+		std::cout << "Colouring:   " << ((distance) ? "distance" : (histogram) ? "histogram" : (smooth) ? "smooth" : "integer") << std::endl;
 	}
 
-	std::vector<std::vector<int>> dwellBuffer(res, std::vector<int>(res, -1));
-	vector<thread> threads;
-	unsigned int const NUM_THREAD = thread::hardware_concurrency();
-
-
-	if (mariani) {
-		// Scale the blockSize from res up to a subdividable value
-		// Number of possible subdivisions:
-		unsigned int const numDiv = std::ceil(std::log((double) res/blockDim)/std::log((double) subDiv));
-		// Calculate a dividable resolution for the blockSize:
-		unsigned int const correctedBlockSize = std::pow(subDiv,numDiv) * blockDim;
-		// Mariani-Silver subdivision algorithm
-
-		//addWork(job{dwellBuffer, 0, 0, 0, correctedBlockSize, dc, cmin});
-		// Initialize the variable to 1 in order to execute the first step
-		//limit = 1;
-
-		// Initialize the vector of threads and make them execute the worker function
-		for(unsigned int i=0;i<NUM_THREAD; i++) {
-			threads.push_back(
-				thread(
-					worker,
-					ref(dwellBuffer)
-				)
-			);
+	DwellFile dwellFile;
+	DwellBuffer dwellBuffer;
+	// Window the dwell values were sampled from, taken from the header when recolouring
+	std::complex<double> viewMin = cmin;
+	std::complex<double> viewSize = dc;
+	if (!recolourInput.empty()) {
+		// Recolour only: the dwell values come from a previous render, no iterations are run
+		if (!dwellFile.open(recolourInput)) {
+			std::cout << "An error occurred while reading the dwell file: " << dwellFile.error() << std::endl;
+			return 1;
 		}
-
-		// Wait for all the thread to finish
-		for(unsigned int i=0;i<NUM_THREAD; i++) {
-			threads.at(i).join();
+		DwellHeader const &header = dwellFile.header();
+		if (header.dtype != DwellType::Int32 || header.width == 0 || header.height == 0) {
+			std::cout << "Unsupported dwell file: " << recolourInput << std::endl;
+			return 1;
+		}
+		imageWidth = header.width;
+		imageHeight = header.height;
+		res = std::min(imageWidth, imageHeight);
+		maxDwell = header.maxDwell;
+		viewMin = std::complex<double>(header.cminRe, header.cminIm);
+		viewSize = std::complex<double>(header.dcRe, header.dcIm);
+		dwellBuffer = dwellFile.dwell();
+		if (!quiet) {
+			std::cout << "Recolouring: " << recolourInput << " (" << imageWidth << "x" << imageHeight << ", " << maxDwell << " iterations)" << std::endl;
 		}
-
-		//Call to the original implementation of mariani silver
-		//marianiSilverOriginal(dwellBuffer, cmin, dc, 0, 0, correctedBlockSize);
-
-		//Call to the parallelized version of mariani silver
-		//marianiSilver(dwellBuffer, cmin, dc, 0, 0, correctedBlockSize);
 	} else {
-		// Traditional Mandelbrot-Set computation or the 'Escape Time' algorithm.
-		//implementation is now threaded
-		unsigned int const HEIGHT_PER_THREAD = res / NUM_THREAD;
-
-		// Initialize the vector of threads and make them execute the threadedComputeBlock function
-		for(unsigned int i=0;i<NUM_THREAD; i++) {
-			threads.push_back(
-
-				thread(
-					threadedComputeBlock,
-
-					ref(dwellBuffer),
-					cmin,
-					dc,
-					HEIGHT_PER_THREAD * i,
-					0,
-					HEIGHT_PER_THREAD,0
-				)
-			);
+		// With a dwell file the renderer writes straight into the mapped pages of the file
+		if (dwellOutput.empty()) {
+			dwellBuffer = DwellBuffer(imageWidth, imageHeight, -1, smooth && !distance, distance);
+		} else {
+			DwellHeader const header = makeDwellHeader(DwellType::Int32, distance ? (uint32_t) dwellFlagDistance : smooth ? (uint32_t) dwellFlagFraction : 0u, imageWidth, imageHeight, maxDwell, cmin.real(), cmin.imag(), dc.real(), dc.imag());
+			if (!dwellFile.create(dwellOutput, header)) {
+				std::cout << "An error occurred while creating the dwell file: " << dwellFile.error() << std::endl;
+				return 1;
+			}
+			dwellBuffer = dwellFile.dwell();
+			dwellBuffer.fill(-1);
 		}
-
-		// Wait for all the thread to finish
-		for(unsigned int i=0;i<NUM_THREAD; i++) {
-			threads.at(i).join();
+		{
+			StatsTimer timer(phases.render);
+			TraceSpan span("render");
+			if (progressive) {
+				// The levels are coloured as they are done
+				createColourMap(histogram ? maxDwell : maxDwell / colourIterations);
+				createColourTables(maxDwell);
+				unsigned int const progressiveError = renderProgressive(dwellBuffer, cmin, dc, histogram, output, progressiveStream, pngLevel, latencies);
+				if (progressiveError) {
+					std::cout << "An error occurred while writing a progressive level: " << progressiveError << ": " << lodepng_error_text(progressiveError) << std::endl;
+					return 1;
+				}
+			}
+#ifdef USE_MPI
+			else if (mpi.size > 1) {
+				renderDistributed(mpi, grid, dwellBuffer, smooth && !distance, distance, cmin, dc, engine, threadCount, quiet);
+			}
+#endif
+			else {
+				render(dwellBuffer, cmin, dc, engine, threadCount);
+			}
+		}
+		if (!quiet && progressive) {
+			std::cout << "Progressive:";
+			for (size_t i = 0; i < latencies.size(); i++) {
+				std::cout << ((i) ? ", 1/" : " 1/") << progressiveSteps[i] << " after " << std::setprecision(1) << 1e3 * latencies[i] << " ms";
+			}
+			std::cout << std::endl;
+		}
+		if (!quiet) {
+			std::cout << "Evaluated:   " << statsTotal.evaluated << " pixels (" << std::fixed << std::setprecision(1)
+					  << 100.0 * statsTotal.evaluated / dwellBuffer.size() << "%)" << std::endl;
+			if (engine == Engine::Queue && adaptive) {
+				std::cout << "Blocks:      " << statsTotal.decisions[0] << " filled, " << statsTotal.decisions[1] << " computed, "
+						  << statsTotal.decisions[2] << " split 2x2, " << statsTotal.decisions[3] << " split 4x4" << std::endl;
+			}
 		}
-
-		if (mark)
-			markBorder(dwellBuffer, dwellCompute, 0, 0, res);
 	}
 
-	// Add here the worker for Task 2
-
 	// The colour iterations defines how often the colour gradient will
 	// be seen on the final picture. Basically the repetitive factor
-	createColourMap(maxDwell / colourIterations);
-	std::vector<unsigned char> frameBuffer(res * res * 4, 0);
-	unsigned char *pixel = &(frameBuffer.at(0));
-
-	// Map the dwellBuffer to the frameBuffer
-	for (unsigned int y = 0; y < res; y++) {
-		for (unsigned int x = 0; x < res; x++) {
-			// Getting a colour from the map depending on the dwell value and
-			// the coordinates as a complex number. This  method is responsible
-			// for all the nice colours you see
-			rgba const &colour = dwellColor(std::complex<double>(x,y), dwellBuffer.at(y).at(x));
-			// class rgba provides a method to directly write a colour into a
-			// framebuffer. The address to the next pixel is hereby returned
-			pixel = colour.putFramebuffer(pixel);
+	// With histogram equalization the map is spread by frequency instead, so its repetition is dropped
+	std::vector<unsigned char> frameBuffer((size_t) imageWidth * imageHeight * 4, 0);
+	{
+		StatsTimer timer(phases.colour);
+		TraceSpan span("colour");
+		createColourMap(histogram ? maxDwell : maxDwell / colourIterations);
+		createColourTables(maxDwell);
+		colourBuffer(dwellBuffer, histogram, frameBuffer);
+	}
+	if (aaGrid > 0 && !mark) {
+		unsigned long long supersampled;
+		{
+			StatsTimer timer(phases.antialias);
+			TraceSpan span("antialias");
+			supersampled = antialiasFrame(dwellBuffer, viewMin, viewSize, aaGrid, aaThreshold, frameBuffer);
+		}
+		if (!quiet) {
+			std::cout << "Antialiased: " << supersampled << " pixels (" << std::fixed << std::setprecision(1)
+					  << 100.0 * supersampled / dwellBuffer.size() << "%)" << std::endl;
 		}
 	}
 
-	unsigned int const error = lodepng::encode(output, frameBuffer, res, res);
+	if (progressiveStream) {
+		writePpm(std::cout, frameBuffer, imageWidth, imageHeight);
+	}
+
+	unsigned int error;
+	{
+		StatsTimer timer(phases.encode);
+		TraceSpan span("encode");
+		error = png::encode(output, frameBuffer, imageWidth, imageHeight, pngLevel);
+	}
 	if (error) {
 		std::cout << "An error occurred while writing the image file: " << error << ": " << lodepng_error_text(error) << std::endl;
 		return 1;
 	}
 
+	if (heatmap) {
+		heatmapFrame(frameBuffer);
+		unsigned int const heatmapError = png::encode(heatmapOutput, frameBuffer, imageWidth, imageHeight, pngLevel);
+		if (heatmapError) {
+			std::cout << "An error occurred while writing the heat map: " << heatmapError << ": " << lodepng_error_text(heatmapError) << std::endl;
+			return 1;
+		}
+		std::string const blocksOutput = pathWithSuffix(heatmapOutput, ".csv");
+		if (!writeHeatBlocks(blocksOutput)) {
+			std::cout << "An error occurred while writing the heat map blocks: " << blocksOutput << std::endl;
+			return 1;
+		}
+		if (!quiet) {
+			std::cout << "Heat map:    " << heatmapOutput << ", " << heatBlocks.size() << " blocks in " << blocksOutput << std::endl;
+		}
+	}
+
+	if (!previewOutput.empty()) {
+		std::vector<unsigned char> previewBuffer((size_t) costColumns * costRows * 4);
+		for (size_t i = 0; i < costMap.size(); i++) {
+			std::memcpy(&previewBuffer[4 * i], &dwellColour(costMap[i]), 4);
+		}
+		unsigned int const previewError = png::encode(previewOutput, previewBuffer, costColumns, costRows, pngLevel);
+		if (previewError) {
+			std::cout << "An error occurred while writing the preview: " << previewError << ": " << lodepng_error_text(previewError) << std::endl;
+			return 1;
+		}
+		if (!quiet) {
+			std::cout << "Preview:     " << previewOutput << " (" << costColumns << "x" << costRows << ")" << std::endl;
+		}
+	}
+
+	if (tracing) {
+		std::ofstream file(traceOutput);
+		unsigned long long const dropped = writeTrace(file);
+		file.close();
+		if (!file) {
+			std::cout << "An error occurred while writing the trace file: " << traceOutput << std::endl;
+			return 1;
+		}
+		if (!quiet && dropped > 0) {
+			std::cout << "Trace:       " << dropped << " early spans dropped by full buffers" << std::endl;
+		}
+	}
+
+	if (collectStats) {
+		// Streamed frames own stdout
+		printStats(progressiveStream ? std::cerr : std::cout, phases, dwellBuffer.size(), false);
+		if (!statsOutput.empty()) {
+			std::ofstream file(statsOutput);
+			printStats(file, phases, dwellBuffer.size(), true);
+			file.close();
+			if (!file) {
+				std::cout << "An error occurred while writing the stats file: " << statsOutput << std::endl;
+				return 1;
+			}
+		}
+	}
+
 	return 0;
 }
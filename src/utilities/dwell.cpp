@@ -0,0 +1,252 @@
+#include "dwell.hpp"
+#include "lodepng.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+size_t dwellTypeSize(DwellType const dtype) {
+	switch (dtype) {
+		case DwellType::Int32:
+			return sizeof(int32_t);
+	}
+	return 0;
+}
+
+size_t dwellPayloadSize(DwellHeader const &header) {
+	size_t const pixels = (size_t) header.width * header.height;
+	size_t size = pixels * dwellTypeSize(header.dtype);
+	if (header.flags & dwellFlagFraction) {
+		size += pixels * sizeof(float);
+	}
+	if (header.flags & dwellFlagDistance) {
+		size += pixels * sizeof(float);
+	}
+	return size;
+}
+
+DwellHeader makeDwellHeader(DwellType const dtype,
+							uint32_t const flags,
+							unsigned int const width,
+							unsigned int const height,
+							unsigned int const maxDwell,
+							double const cminRe,
+							double const cminIm,
+							double const dcRe,
+							double const dcIm)
+{
+	DwellHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, dwellFileMagic, sizeof(header.magic));
+	header.version = dwellFileVersion;
+	header.dtype = dtype;
+	header.flags = flags;
+	header.width = width;
+	header.height = height;
+	header.maxDwell = maxDwell;
+	header.cminRe = cminRe;
+	header.cminIm = cminIm;
+	header.dcRe = dcRe;
+	header.dcIm = dcIm;
+	return header;
+}
+
+bool DwellFile::fail(std::string const &what, std::string const &path) {
+	errorMessage = what + " '" + path + "': " + std::strerror(errno);
+	close();
+	return false;
+}
+
+bool DwellFile::create(std::string const &path, DwellHeader const &header) {
+	close();
+	mappingSize = dwellFilePayload + dwellPayloadSize(header);
+
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return fail("Could not create dwell file", path);
+	}
+	if (ftruncate(fd, mappingSize) != 0) {
+		return fail("Could not resize dwell file", path);
+	}
+	mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mapping == MAP_FAILED) {
+		mapping = nullptr;
+		return fail("Could not map dwell file", path);
+	}
+	std::memcpy(mapping, &header, sizeof(header));
+	return true;
+}
+
+bool DwellFile::open(std::string const &path) {
+	close();
+	fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return fail("Could not open dwell file", path);
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		return fail("Could not stat dwell file", path);
+	}
+	mappingSize = info.st_size;
+	if (mappingSize < dwellFilePayload) {
+		errno = EINVAL;
+		return fail("Truncated dwell file", path);
+	}
+	mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (mapping == MAP_FAILED) {
+		mapping = nullptr;
+		return fail("Could not map dwell file", path);
+	}
+
+	DwellHeader const &head = header();
+	if (std::memcmp(head.magic, dwellFileMagic, sizeof(head.magic)) != 0 || head.version != dwellFileVersion) {
+		errno = EINVAL;
+		return fail("Not a dwell file", path);
+	}
+	if (dwellTypeSize(head.dtype) == 0 || (head.flags & ~(dwellFlagFraction | dwellFlagDistance)) != 0) {
+		errno = EINVAL;
+		return fail("Unsupported dwell file", path);
+	}
+	if (mappingSize < dwellFilePayload + dwellPayloadSize(head)) {
+		errno = EINVAL;
+		return fail("Truncated dwell file", path);
+	}
+	// Pixels are read front to back
+	madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+	return true;
+}
+
+DwellBuffer DwellFile::dwell() {
+	DwellHeader const &head = header();
+	size_t const pixels = (size_t) head.width * head.height;
+	int *values = static_cast<int *>(data());
+	float *plane = reinterpret_cast<float *>(values + pixels);
+	float *fractions = nullptr;
+	float *distances = nullptr;
+	if (head.flags & dwellFlagFraction) {
+		fractions = plane;
+		plane += pixels;
+	}
+	if (head.flags & dwellFlagDistance) {
+		distances = plane;
+	}
+	return DwellBuffer(values, fractions, distances, head.width, head.height);
+}
+
+void DwellFile::close() {
+	if (mapping) {
+		munmap(mapping, mappingSize);
+		mapping = nullptr;
+	}
+	if (fd >= 0) {
+		::close(fd);
+		fd = -1;
+	}
+	mappingSize = 0;
+}
+
+// Number of planes of a buffer and a pointer to the first value of row y of plane i. The planes
+// hold int and float values of 4 bytes, they are only ever accessed bytewise through memcpy.
+static unsigned int planeCount(DwellBuffer const &buffer) {
+	return 1 + buffer.hasFraction() + buffer.hasDistance();
+}
+
+static void const *planeRow(DwellBuffer const &buffer, unsigned int const plane, unsigned int const y) {
+	if (plane == 0) {
+		return buffer.row(y);
+	}
+	if (plane == 1 && buffer.hasFraction()) {
+		return buffer.fractionData() + (size_t) y * buffer.width();
+	}
+	return buffer.distanceRow(y);
+}
+
+static void *planeRow(DwellBuffer &buffer, unsigned int const plane, unsigned int const y) {
+	return const_cast<void *>(planeRow(static_cast<DwellBuffer const &>(buffer), plane, y));
+}
+
+// Bytes of a row of every plane
+static size_t rowBytes(unsigned int const width) {
+	return (size_t) width * sizeof(uint32_t);
+}
+
+unsigned packDwell(DwellBuffer const &buffer, std::vector<unsigned char> &out) {
+	unsigned int const w = buffer.width();
+	std::vector<uint32_t> deltas(buffer.size() * planeCount(buffer));
+	uint32_t *delta = deltas.data();
+	for (unsigned int plane = 0; plane < planeCount(buffer); plane++) {
+		for (unsigned int y = 0; y < buffer.height(); y++) {
+			unsigned char const *row = static_cast<unsigned char const *>(planeRow(buffer, plane, y));
+			uint32_t left = 0;
+			for (unsigned int x = 0; x < w; x++) {
+				uint32_t value;
+				std::memcpy(&value, row + x * sizeof(uint32_t), sizeof(value));
+				*delta++ = value - left;
+				left = value;
+			}
+		}
+	}
+	// The differences of flat areas are zero bytes, the run and scanline LZ77 finds those
+	// without hash chains
+	LodePNGCompressSettings settings = lodepng_default_compress_settings;
+	settings.fastlz77 = rowBytes(w);
+	out.clear();
+	return lodepng::compress(out, reinterpret_cast<unsigned char const *>(deltas.data()),
+							 deltas.size() * sizeof(uint32_t), settings);
+}
+
+unsigned unpackDwell(std::vector<unsigned char> const &in,
+					 DwellBuffer &target,
+					 unsigned int const atY,
+					 unsigned int const atX,
+					 unsigned int const width,
+					 unsigned int const height)
+{
+	std::vector<unsigned char> raw;
+	unsigned const error = lodepng::decompress(raw, in);
+	if (error) {
+		return error;
+	}
+	unsigned int const planes = planeCount(target);
+	if (raw.size() != (size_t) width * height * planes * sizeof(uint32_t)) {
+		// Same code as lodepng's for a size mismatch of the decompressed data
+		return 91;
+	}
+	unsigned char const *delta = raw.data();
+	for (unsigned int plane = 0; plane < planes; plane++) {
+		for (unsigned int y = 0; y < height; y++) {
+			unsigned char *row = static_cast<unsigned char *>(planeRow(target, plane, atY + y)) + rowBytes(atX);
+			uint32_t left = 0;
+			for (unsigned int x = 0; x < width; x++) {
+				uint32_t step;
+				std::memcpy(&step, delta, sizeof(step));
+				delta += sizeof(step);
+				left += step;
+				std::memcpy(row + x * sizeof(uint32_t), &left, sizeof(left));
+			}
+		}
+	}
+	return 0;
+}
+
+void copyDwell(DwellBuffer const &source, DwellBuffer &target, unsigned int const atY, unsigned int const atX) {
+	for (unsigned int plane = 0; plane < planeCount(source); plane++) {
+		for (unsigned int y = 0; y < source.height(); y++) {
+			std::memcpy(static_cast<unsigned char *>(planeRow(target, plane, atY + y)) + rowBytes(atX),
+						planeRow(source, plane, y), rowBytes(source.width()));
+		}
+	}
+}
+
+void extractDwell(DwellBuffer const &source, unsigned int const atY, unsigned int const atX, DwellBuffer &target) {
+	for (unsigned int plane = 0; plane < planeCount(target); plane++) {
+		for (unsigned int y = 0; y < target.height(); y++) {
+			std::memcpy(planeRow(target, plane, y),
+						static_cast<unsigned char const *>(planeRow(source, plane, atY + y)) + rowBytes(atX),
+						rowBytes(target.width()));
+		}
+	}
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Data types of the dwell plane in a dwell file
+enum class DwellType : uint32_t { Int32 = 1 };
+
+// Optional planes of a dwell file, stored after the dwell plane in this order
+enum DwellFlags : uint32_t { dwellFlagFraction = 1, dwellFlagDistance = 2 };
+
+/**
+* Header of a raw dwell file. The file is the header, padded to dwellFilePayload bytes so the
+* payload is page aligned, followed by height rows of width dwell values in native byte order.
+* With dwellFlagFraction a plane of width x height floats with the fractional dwell follows,
+* with dwellFlagDistance one with the exterior distance estimate in pixels.
+* The viewport is stored as the corner cmin and the extent dc of the complex window. dc spans
+* min(width, height) pixels, not the whole image: pixel (x, y) samples cmin + (x, y) / min(width,
+* height) * dc, so the pixel pitch is dc / min(width, height) along both axes.
+*/
+struct DwellHeader {
+	char magic[8];
+	uint32_t version;
+	DwellType dtype;
+	uint32_t width;
+	uint32_t height;
+	uint32_t maxDwell;
+	uint32_t flags;
+	double cminRe;
+	double cminIm;
+	double dcRe;
+	double dcIm;
+};
+
+static constexpr const char dwellFileMagic[8] = { 'M', 'A', 'N', 'D', 'W', 'E', 'L', 'L' };
+static constexpr const uint32_t dwellFileVersion = 1;
+static constexpr const size_t dwellFilePayload = 4096;
+
+size_t dwellTypeSize(DwellType const dtype);
+// Size of the payload after the padded header, including the optional planes
+size_t dwellPayloadSize(DwellHeader const &header);
+
+/**
+* Row major 2D buffer of dwell values. Either owns its memory or is a view on memory owned by
+* someone else, e.g. the mapped pages of a DwellFile, so the renderer can write straight into it.
+* Optionally carries a plane with the normalized fractional iteration count of every pixel,
+* the amount in [0;1) the continuous dwell lies below the integer dwell, for smooth colouring,
+* and a plane with the exterior distance estimate of every pixel in pixels (0 inside the set).
+*/
+class DwellBuffer {
+public:
+	DwellBuffer() : values(nullptr), fractions(nullptr), distances(nullptr), w(0), h(0) {}
+	DwellBuffer(unsigned int const width,
+				unsigned int const height,
+				int const value,
+				bool const withFraction = false,
+				bool const withDistance = false)
+		: storage((size_t) width * height, value),
+		  fractionStorage(withFraction ? (size_t) width * height : 0, 0.0f),
+		  distanceStorage(withDistance ? (size_t) width * height : 0, 0.0f),
+		  values(storage.data()),
+		  fractions(withFraction ? fractionStorage.data() : nullptr),
+		  distances(withDistance ? distanceStorage.data() : nullptr),
+		  w(width), h(height) {}
+	DwellBuffer(int *data, float *fractionData, float *distanceData, unsigned int const width, unsigned int const height)
+		: values(data), fractions(fractionData), distances(distanceData), w(width), h(height) {}
+
+	DwellBuffer(DwellBuffer const &) = delete;
+	DwellBuffer &operator=(DwellBuffer const &) = delete;
+	// Moving a vector keeps its heap buffer, so values stays valid
+	DwellBuffer(DwellBuffer &&other) = default;
+	DwellBuffer &operator=(DwellBuffer &&other) = default;
+
+	int &at(unsigned int const y, unsigned int const x) { return values[(size_t) y * w + x]; }
+	int at(unsigned int const y, unsigned int const x) const { return values[(size_t) y * w + x]; }
+	int *row(unsigned int const y) { return values + (size_t) y * w; }
+	int const *row(unsigned int const y) const { return values + (size_t) y * w; }
+	int *data() { return values; }
+	int const *data() const { return values; }
+
+	bool hasFraction() const { return fractions != nullptr; }
+	float &fraction(unsigned int const y, unsigned int const x) { return fractions[(size_t) y * w + x]; }
+	float const *fractionData() const { return fractions; }
+
+	bool hasDistance() const { return distances != nullptr; }
+	float &distance(unsigned int const y, unsigned int const x) { return distances[(size_t) y * w + x]; }
+	float *distanceRow(unsigned int const y) { return distances + (size_t) y * w; }
+	float const *distanceRow(unsigned int const y) const { return distances + (size_t) y * w; }
+
+	unsigned int width() const { return w; }
+	unsigned int height() const { return h; }
+	size_t size() const { return (size_t) w * h; }
+
+	void fill(int const value) { std::fill(values, values + size(), value); }
+
+private:
+	std::vector<int> storage;
+	std::vector<float> fractionStorage;
+	std::vector<float> distanceStorage;
+	int *values;
+	float *fractions;
+	float *distances;
+	unsigned int w;
+	unsigned int h;
+};
+
+/**
+* Memory mapped dwell file. create() sizes and maps a new file writable and shared, so every
+* write to data() ends up in the file without an extra copy. open() maps an existing file
+* private (copy on write): reading is zero-copy and modifications never reach the file.
+*/
+class DwellFile {
+public:
+	DwellFile() : fd(-1), mapping(nullptr), mappingSize(0) {}
+	~DwellFile() { close(); }
+
+	DwellFile(DwellFile const &) = delete;
+	DwellFile &operator=(DwellFile const &) = delete;
+
+	bool create(std::string const &path, DwellHeader const &header);
+	bool open(std::string const &path);
+	void close();
+
+	bool isOpen() const { return mapping != nullptr; }
+	DwellHeader const &header() const { return *static_cast<DwellHeader const *>(mapping); }
+	void *data() { return static_cast<char *>(mapping) + dwellFilePayload; }
+	// View on the dwell plane of an Int32 file, and its optional planes
+	DwellBuffer dwell();
+
+	std::string const &error() const { return errorMessage; }
+
+private:
+	bool fail(std::string const &what, std::string const &path);
+
+	int fd;
+	void *mapping;
+	size_t mappingSize;
+	std::string errorMessage;
+};
+
+// Fills in magic, version and the given properties of a dwell file header
+DwellHeader makeDwellHeader(DwellType const dtype,
+							uint32_t const flags,
+							unsigned int const width,
+							unsigned int const height,
+							unsigned int const maxDwell,
+							double const cminRe,
+							double const cminIm,
+							double const dcRe,
+							double const dcIm);
+
+/**
+* Zlib compressed planes of a dwell buffer, for sending rendered tiles between processes.
+* Every plane is stored as the difference of each value to its left neighbour, which turns
+* the flat areas of a render into runs of zeros. Returns a lodepng error code, 0 on success.
+*/
+unsigned packDwell(DwellBuffer const &buffer, std::vector<unsigned char> &out);
+// Unpacks a packed buffer of the same size and planes into the region of target at atY, atX
+unsigned unpackDwell(std::vector<unsigned char> const &in,
+					 DwellBuffer &target,
+					 unsigned int const atY,
+					 unsigned int const atX,
+					 unsigned int const width,
+					 unsigned int const height);
+// Copies all planes of source into the region of target at atY, atX, which has the same planes
+void copyDwell(DwellBuffer const &source, DwellBuffer &target, unsigned int const atY, unsigned int const atX);
+// Copies the region at atY, atX of source with the size of target into target, which has the same planes
+void extractDwell(DwellBuffer const &source, unsigned int const atY, unsigned int const atX, DwellBuffer &target);
@@ -290,6 +290,10 @@ struct LodePNGCompressSettings /*deflate = compress*/
   unsigned minmatch; /*mininum lz77 length. 3 is normally best, 6 can be better for some PNGs. Default: 0*/
   unsigned nicematch; /*stop searching if >= this length found. Set to 258 for best compression. Default: 128*/
   unsigned lazymatching; /*use lazy matching: better compression but a bit slower. Default: true*/
+  /*if non-zero, use a fast LZ77 without hash chains that only tries matches at distance 1 (runs) and at
+  distance fastlz77 (the previous scanline). The PNG encoder replaces any non-zero value with the length of
+  a filtered scanline. Much faster on images with large flat areas. Default: 0*/
+  unsigned fastlz77;
 
   /*use custom zlib encoder instead of built in one (default: null)*/
   unsigned (*custom_zlib)(unsigned char**, size_t*,
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "lodepng.h"
+
+namespace png {
+	// Encoder profiles, from fastest to smallest output
+	enum class Level { Store, Fast, Default, Max };
+
+	inline bool parseLevel(std::string const &name, Level &level) {
+		if (name == "store") level = Level::Store;
+		else if (name == "fast") level = Level::Fast;
+		else if (name == "default") level = Level::Default;
+		else if (name == "max") level = Level::Max;
+		else return false;
+		return true;
+	}
+
+	inline char const *levelName(Level const level) {
+		switch (level) {
+			case Level::Store: return "store";
+			case Level::Fast: return "fast";
+			case Level::Default: return "default";
+			case Level::Max: return "max";
+		}
+		return "unknown";
+	}
+
+	// Encodes an RGBA framebuffer of w x h pixels with the given profile into out
+	inline unsigned encode(std::vector<unsigned char> &out,
+						   std::vector<unsigned char> const &image,
+						   unsigned int const w,
+						   unsigned int const h,
+						   Level const level)
+	{
+		lodepng::State state;
+		// Has to outlive the encode call, lodepng only keeps the pointer
+		std::vector<unsigned char> filters;
+		LodePNGCompressSettings &zlib = state.encoder.zlibsettings;
+
+		switch (level) {
+			case Level::Store:
+				// No deflate and no filtering, the output is basically the raw image
+				zlib.btype = 0;
+				state.encoder.filter_palette_zero = 0;
+				state.encoder.filter_strategy = LFS_ZERO;
+				state.encoder.auto_convert = 0;
+				break;
+			case Level::Fast:
+				// The renders consist of large flat areas: the Sub filter turns them into
+				// zeros, which the run/scanline LZ77 matches without hash chains.
+				// Skipping the colour analysis of auto_convert saves a full pass as well.
+				zlib.fastlz77 = 1;
+				filters.assign(h, 1);
+				state.encoder.filter_palette_zero = 0;
+				state.encoder.filter_strategy = LFS_PREDEFINED;
+				state.encoder.predefined_filters = filters.data();
+				state.encoder.auto_convert = 0;
+				break;
+			case Level::Default:
+				break;
+			case Level::Max:
+				zlib.windowsize = 32768;
+				zlib.nicematch = 258;
+				break;
+		}
+		return lodepng::encode(out, image, w, h, state);
+	}
+
+	inline unsigned encode(std::string const &filename,
+						   std::vector<unsigned char> const &image,
+						   unsigned int const w,
+						   unsigned int const h,
+						   Level const level)
+	{
+		std::vector<unsigned char> buffer;
+		unsigned const error = encode(buffer, image, w, h, level);
+		if (error) {
+			return error;
+		}
+		return lodepng::save_file(buffer, filename);
+	}
+}